@@ -5,6 +5,12 @@
 #include "Math/UnrealMathUtility.h"
 
 #include "DrawDebugHelpers.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+//"stat PlayerMovement" in game
+DECLARE_STATS_GROUP(TEXT("PlayerMovement"), STATGROUP_PlayerMovement, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("Calculate Moving Force"), STAT_PlayerCalculateMovingForce, STATGROUP_PlayerMovement);
+DECLARE_CYCLE_STAT(TEXT("Ground Trace"), STAT_PlayerGroundTrace, STATGROUP_PlayerMovement);
 
 // Sets default values for this component's properties
 UPlayerMovementComponent::UPlayerMovementComponent()
@@ -75,6 +81,9 @@ void UPlayerMovementComponent::SetComponents(UCapsuleComponent* Capsule, USceneC
 
 void UPlayerMovementComponent::CalculateMovingForce()
 {
+	SCOPE_CYCLE_COUNTER(STAT_PlayerCalculateMovingForce);
+	TRACE_CPUPROFILER_EVENT_SCOPE(STAT_PlayerCalculateMovingForce);
+
 	FVector TotalForce = (ForwardMovingForce + RightMovingForce).GetSafeNormal() * GetWorld()->GetDeltaSeconds();
 	FVector PlayerVel = CapsuleRef->GetPhysicsLinearVelocity();
 	float speedXY = FVector(PlayerVel.X, PlayerVel.Y, 0.f).Size();
@@ -197,6 +206,9 @@ void UPlayerMovementComponent::Jump()
 
 FHitResult UPlayerMovementComponent::GroundTrace()
 {
+	SCOPE_CYCLE_COUNTER(STAT_PlayerGroundTrace);
+	TRACE_CPUPROFILER_EVENT_SCOPE(STAT_PlayerGroundTrace);
+
 	FHitResult OutHit;
 
 	if (CapsuleRef) {
@@ -2,6 +2,9 @@
 
 
 #include "Boid.h"
+#include "FlockManager.h"
+#include "BoidSnapshotSubsystem.h"
+#include "FlockStats.h"
 #include "Components/SphereComponent.h"
 #include "Components/SceneComponent.h"
 #include "Components/StaticMeshComponent.h"
@@ -64,6 +67,25 @@ ABoid::ABoid()
 	TraceLength = 400.f;
 	DistanceFromSpawn = 1000.f;
 
+	Manager = nullptr;
+	FlockIndex = INDEX_NONE;
+	Species = 0;
+	FlockOrientation = FQuat::Identity;
+
+	Snapshot = nullptr;
+	SnapshotSlot = INDEX_NONE;
+
+	bKinematic = false;
+	MaxSpeed = 1500.f;
+	ContactStiffness = 200.f;
+
+	KinematicVelocity = FVector::ZeroVector;
+	KinematicAcceleration = FVector::ZeroVector;
+	RuleTimer = 0.f;
+	RuleInterval = PrimaryActorTick.TickInterval;
+	bTickPhaseSet = false;
+	bPooled = false;
+
 }
 
 // Called when the game starts or when spawned
@@ -71,31 +93,148 @@ void ABoid::BeginPlay()
 {
 	Super::BeginPlay();
 
-	//Calculate a constant for function timer Tick Rate
-	float OrientUpdateRate = 1.f / 30.f; //30 fps
-
-	//Set Timer
-	GetWorld()->GetTimerManager().SetTimer(FT_Handle_AutoOrient, this, &ABoid::AutoOrient, OrientUpdateRate, true);
+	Snapshot = GetWorld()->GetSubsystem<UBoidSnapshotSubsystem>();
+	if (Snapshot != nullptr) {
+		SnapshotSlot = Snapshot->Register(this);
+	}
 
 	//Get a list in the beginning
 	GetOverlappingActors(Boids, TSubclassOf<ABoid>());
+	UpdateNeighbourSlots();
+
+	RuleInterval = PrimaryActorTick.TickInterval;
+
+	if (bKinematic) {
+		//Movement is integrated here now, tick every frame and keep the rules on their own timer
+		SetActorTickInterval(0.f);
+
+		//Random phase, so boids spawned together don't all run their rules on the same frame
+		RuleTimer = FMath::FRandRange(0.f, RuleInterval);
+	}
+}
+
+void ABoid::PreRegisterAllComponents()
+{
+	Super::PreRegisterAllComponents();
+
+	if (bKinematic) {
+		ApplyKinematicSettings();
+	}
 }
 
 // Called every frame
 void ABoid::Tick(float DeltaTime)
 {
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_BoidTick);
+
 	Super::Tick(DeltaTime);
 
+	if (bKinematic) {
+		KinematicTick(DeltaTime);
+	}
+	else {
+		//TotalVelocity actually alter the change in acceleration
+		RootSphere->AddForce(ComputeSteering(), NAME_None, true);
+
+		//Boids spawned on the same frame would all tick together every interval,
+		//the second tick comes after a random share of it to spread them over frames
+		if (!bTickPhaseSet) {
+			bTickPhaseSet = true;
+			SetActorTickInterval(FMath::FRandRange(0.f, RuleInterval));
+		}
+		else if (GetActorTickInterval() != RuleInterval) {
+			SetActorTickInterval(RuleInterval);
+		}
+	}
+
+	//Used to be a 30 Hz timer per boid, now part of the tick
+	AutoOrient(DeltaTime);
+}
+
+FVector ABoid::ComputeSteering()
+{
 	FVector TotalVelocity;
 	TotalVelocity = MoveTowardOrigin() + OrthonormalVelocity(VortexClockwise);// +TraceObstacle();
 	TotalVelocity = TotalVelocity.GetSafeNormal();
 
 	TotalVelocity += Cohesion() + Separation() + Alignment();
 
-	TotalVelocity = TotalVelocity.GetSafeNormal() * SpeedScale;
+	return TotalVelocity.GetSafeNormal() * SpeedScale;
+}
+
+void ABoid::KinematicTick(float DeltaTime)
+{
+	RuleTimer -= DeltaTime;
+	if (RuleTimer <= 0.f) {
+		KinematicAcceleration = ComputeSteering() + ContactPush() * ContactStiffness;
+		RuleTimer += RuleInterval;
+		if (RuleTimer <= 0.f) RuleTimer = RuleInterval;
+	}
+
+	KinematicVelocity = (KinematicVelocity + KinematicAcceleration * DeltaTime).GetClampedToMaxSize(MaxSpeed);
+
+	AddActorWorldOffset(KinematicVelocity * DeltaTime);
+
+	//Keeps GetVelocity working for AutoOrient and the neighbours' Alignment
+	RootSphere->ComponentVelocity = KinematicVelocity;
+}
+
+FVector ABoid::ContactPush()
+{
+	FVector Push = FVector::ZeroVector;
+	if (!PrepareSnapshot()) return Push;
+
+	const FVector Location = Snapshot->GetPosition(SnapshotSlot);
+	const float ContactDistance = 2.f * RootSphere->GetScaledSphereRadius();
 
-	//TotalVelocity actually alter the change in acceleration
-	RootSphere->AddForce(TotalVelocity, NAME_None, true);
+	for (int32 Slot : NeighbourSlots) {
+		FVector directionFromOther = Location - Snapshot->GetPosition(Slot);
+		float distanceToOther = directionFromOther.Size();
+
+		if (distanceToOther < ContactDistance) {
+			Push += directionFromOther.GetSafeNormal() * (ContactDistance - distanceToOther);
+		}
+	}
+
+	return Push;
+}
+
+void ABoid::ApplyKinematicSettings()
+{
+	//No simulated rigid body on the root. The SensingSphere keeps its query only body and broadphase proxy,
+	//its overlaps are still what fills Boids.
+	RootSphere->SetSimulatePhysics(false);
+	RootSphere->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+}
+
+bool ABoid::PrepareSnapshot()
+{
+	if (Snapshot == nullptr || !Snapshot->IsValidSlot(SnapshotSlot)) return false;
+
+	//Other boids registering or leaving elsewhere leave these slots alone
+	for (int32 Neighbour = 0; Neighbour < NeighbourSlots.Num(); ++Neighbour) {
+		if (Snapshot->GetSerial(NeighbourSlots[Neighbour]) != NeighbourSerials[Neighbour]) {
+			UpdateNeighbourSlots();
+			break;
+		}
+	}
+
+	return true;
+}
+
+void ABoid::UpdateNeighbourSlots()
+{
+	NeighbourSlots.Reset();
+	NeighbourSerials.Reset();
+	if (Snapshot == nullptr) return;
+
+	for (AActor* actor : Boids) {
+		const ABoid* Other = Cast<ABoid>(actor);
+		if (Other != nullptr && Other != this && Snapshot->IsValidSlot(Other->SnapshotSlot)) {
+			NeighbourSlots.Add(Other->SnapshotSlot);
+			NeighbourSerials.Add(Snapshot->GetSerial(Other->SnapshotSlot));
+		}
+	}
 }
 
 
@@ -104,12 +243,12 @@ FVector ABoid::Cohesion()
 	FVector DirectionToClusterMid = FVector::ZeroVector;
 	FVector AveragePosition = FVector::ZeroVector;
 
-	if (Boids.Num() > 0) {
-		for (AActor* actor : Boids) {
-			AveragePosition += actor->GetActorLocation();
+	if (PrepareSnapshot() && NeighbourSlots.Num() > 0) {
+		for (int32 Slot : NeighbourSlots) {
+			AveragePosition += Snapshot->GetPosition(Slot);
 		}
-		AveragePosition /= Boids.Num();
-		DirectionToClusterMid = (AveragePosition - RootSphere->GetRelativeLocation());
+		AveragePosition /= NeighbourSlots.Num();
+		DirectionToClusterMid = (AveragePosition - Snapshot->GetPosition(SnapshotSlot));
 	}
 
 	return DirectionToClusterMid.GetSafeNormal() * CohesionRate;
@@ -120,9 +259,10 @@ FVector ABoid::Separation()
 	FVector DirectionAwayFromCrowd = FVector::ZeroVector;
 	float counter = 0.f;
 
-	if (Boids.Num() > 0) {
-		for (AActor* actor : Boids) {
-			FVector directionFromOther = RootSphere->GetComponentLocation() - actor->GetActorLocation();
+	if (PrepareSnapshot() && NeighbourSlots.Num() > 0) {
+		const FVector Location = Snapshot->GetPosition(SnapshotSlot);
+		for (int32 Slot : NeighbourSlots) {
+			FVector directionFromOther = Location - Snapshot->GetPosition(Slot);
 			float distanceToOther = directionFromOther.Size();
 
 			if (distanceToOther < SeparationLength) {
@@ -143,11 +283,11 @@ FVector ABoid::Alignment()
 {
 	FVector AverageClusterVelocity = FVector::ZeroVector;
 
-	if (Boids.Num() > 0) {
-		for (AActor* actor : Boids) {
-			AverageClusterVelocity += actor->GetVelocity().GetSafeNormal();
+	if (PrepareSnapshot() && NeighbourSlots.Num() > 0) {
+		for (int32 Slot : NeighbourSlots) {
+			AverageClusterVelocity += Snapshot->GetVelocity(Slot).GetSafeNormal();
 		}
-		AverageClusterVelocity /= Boids.Num();
+		AverageClusterVelocity /= NeighbourSlots.Num();
 
 		//Steering formula, that i'm not using...
 		//AverageClusterVelocity = AverageClusterVelocity - RootSphere->GetComponentVelocity();
@@ -160,22 +300,35 @@ void ABoid::OnBeginOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherAct
 {
 	//Update the List if something new enters the area
 	GetOverlappingActors(Boids, TSubclassOf<ABoid>());
+	UpdateNeighbourSlots();
 }
 
 void ABoid::OnEndOverlap(UPrimitiveComponent* OverlappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex)
 {
 	//Update the list if something leaves the area
 	GetOverlappingActors(Boids, TSubclassOf<ABoid>());
+	UpdateNeighbourSlots();
 }
 
 void ABoid::SetSpawnPointLocation(FVector NewSpawnLocation)
 {
 	SpawnLocation = NewSpawnLocation;
 
+	if (Manager != nullptr) {
+		Manager->SetBoidSpawnLocation(FlockIndex, NewSpawnLocation);
+		return;
+	}
+
 	//Move away from spawn point
 	FVector NewVelocity;
 	NewVelocity = (RootSphere->GetRelativeLocation() - SpawnLocation).GetSafeNormal() * SpeedScale * ExpandRate;
 
+	if (bKinematic) {
+		//Same velocity change AddForce would give over one frame
+		KinematicVelocity += NewVelocity * GetWorld()->GetDeltaSeconds();
+		return;
+	}
+
 	RootSphere->AddForce(NewVelocity, NAME_None, true);
 }
 
@@ -268,29 +421,153 @@ FVector ABoid::OrthonormalVelocity(bool bClockwise)
 	return Direction.GetSafeNormal() * VortexRate;
 }
 
-void ABoid::AutoOrient()
+void ABoid::AutoOrient(float DeltaTime)
 {
 	//Orient face to velocity direction
 
-	FRotator TargetOrientation = FRotationMatrix::MakeFromX(RootSphere->GetComponentVelocity().GetSafeNormal()).Rotator();
-	FRotator CurrentOrientation = MeshParent->GetForwardVector().Rotation();
-
-	FRotator RotationDiff = TargetOrientation - CurrentOrientation;
-	RotationDiff *= ReOrientRate;
-	MeshParent->AddRelativeRotation(RotationDiff);
+	const FQuat CurrentOrientation = MeshParent->GetComponentQuat();
+	const FQuat Orientation = FFlockSimulation::OrientTowards(CurrentOrientation, RootSphere->GetComponentVelocity(), ReOrientRate, DeltaTime);
 
-	//2nd optional method for rotation adjustment, this one will snap the rotation at exact rate every tick
-	//FRotator Orientation = FMath::RInterpTo(CurrentOrientation, TargetOrientation, 0.01f, 1.f);
-	//MeshParent->SetRelativeRotation(TargetOrientation);
+	MeshParent->SetWorldRotation(Orientation);
 }
 
 void ABoid::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
 
-	// Ensure the timer is cleared by using the timer handle
-	GetWorld()->GetTimerManager().ClearTimer(FT_Handle_AutoOrient);
+	if (Manager != nullptr) {
+		Manager->UnregisterBoid(this);
+	}
+
+	if (Snapshot != nullptr) {
+		Snapshot->Unregister(SnapshotSlot);
+		SnapshotSlot = INDEX_NONE;
+	}
+}
+
+void ABoid::AttachToFlock(AFlockManager* NewManager, int32 NewFlockIndex)
+{
+	Manager = NewManager;
+	FlockIndex = NewFlockIndex;
+	FlockOrientation = MeshParent->GetComponentQuat();
+
+	//The manager integrates the boid now, a blocking root would only get in the way of traces and other bodies
+	SetActorTickEnabled(false);
+	RootSphere->SetSimulatePhysics(false);
+	RootSphere->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+
+	//Neighbours come from the manager's grid, no need for overlap events anymore
+	SensingSphere->SetGenerateOverlapEvents(false);
+	SensingSphere->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Boids.Empty();
+	NeighbourSlots.Empty();
+	NeighbourSerials.Empty();
+
+	//Standalone boids stop capturing it every frame, they no longer see this one either
+	if (Snapshot != nullptr) {
+		Snapshot->Unregister(SnapshotSlot);
+		SnapshotSlot = INDEX_NONE;
+	}
+}
+
+void ABoid::DetachFromFlock()
+{
+	Manager = nullptr;
+	FlockIndex = INDEX_NONE;
+
+	//Going away anyway, nothing to hand back
+	UWorld* World = GetWorld();
+	if (!HasActorBegunPlay() || IsActorBeingDestroyed() || World == nullptr || World->bIsTearingDown) return;
+
+	//Standalone again, carrying on at the flock's velocity
+	const FVector Velocity = RootSphere->ComponentVelocity;
+	if (bKinematic) {
+		ApplyKinematicSettings();
+		KinematicVelocity = Velocity;
+	}
+	else {
+		RootSphere->SetCollisionEnabled(ECollisionEnabled::QueryAndPhysics);
+		RootSphere->SetSimulatePhysics(true);
+		RootSphere->SetPhysicsLinearVelocity(Velocity);
+	}
+
+	SensingSphere->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	SensingSphere->SetGenerateOverlapEvents(true);
+	UpdateOverlaps();
+	GetOverlappingActors(Boids, TSubclassOf<ABoid>());
+
+	if (Snapshot != nullptr && SnapshotSlot == INDEX_NONE) {
+		SnapshotSlot = Snapshot->Register(this);
+	}
+	UpdateNeighbourSlots();
+
+	SetActorTickEnabled(true);
+}
+
+void ABoid::DeactivateToPool()
+{
+	bPooled = true;
+
+	SetActorTickEnabled(false);
+	SetActorHiddenInGame(true);
+	RootSphere->SetSimulatePhysics(false);
+	SetActorEnableCollision(false);
+
+	//Neighbours stop seeing the boid straight away
+	if (Snapshot != nullptr) {
+		Snapshot->Unregister(SnapshotSlot);
+		SnapshotSlot = INDEX_NONE;
+	}
+	Boids.Empty();
+	NeighbourSlots.Empty();
+	NeighbourSerials.Empty();
+}
+
+void ABoid::ActivateFromPool(const FVector& Location)
+{
+	bPooled = false;
+
+	SetActorLocation(Location, false, nullptr, ETeleportType::ResetPhysics);
+	SetActorHiddenInGame(false);
+	SetActorEnableCollision(true);
 
-	// Alternatively you can clear all timers that belong to this (Actor) instance.
-	//GetWorld()->GetTimerManager().ClearAllTimersForObject(this);
-}
\ No newline at end of file
+	//A flock manager may have turned these off when the boid last joined it
+	SensingSphere->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	SensingSphere->SetGenerateOverlapEvents(true);
+	if (bKinematic) {
+		ApplyKinematicSettings();
+	}
+	else {
+		RootSphere->SetCollisionEnabled(ECollisionEnabled::QueryAndPhysics);
+		RootSphere->SetSimulatePhysics(true);
+		RootSphere->SetPhysicsLinearVelocity(FVector::ZeroVector);
+	}
+
+	KinematicVelocity = FVector::ZeroVector;
+	KinematicAcceleration = FVector::ZeroVector;
+	RootSphere->ComponentVelocity = FVector::ZeroVector;
+
+	if (Snapshot != nullptr) {
+		SnapshotSlot = Snapshot->Register(this);
+	}
+
+	UpdateOverlaps();
+	GetOverlappingActors(Boids, TSubclassOf<ABoid>());
+	UpdateNeighbourSlots();
+
+	SetActorTickEnabled(true);
+}
+
+void ABoid::UpdateFromFlock(const FVector& Location, const FVector& Velocity, const FQuat& Orientation, float OrientThreshold)
+{
+	SetActorLocation(Location, false, nullptr, ETeleportType::TeleportPhysics);
+
+	//Not simulating anymore, keep the velocity readable for GetVelocity
+	RootSphere->ComponentVelocity = Velocity;
+
+	//Orientation comes from the simulation, skip the transform update for tiny changes
+	if (FlockOrientation.AngularDistance(Orientation) > OrientThreshold) {
+		FlockOrientation = Orientation;
+		MeshParent->SetWorldRotation(Orientation);
+	}
+}
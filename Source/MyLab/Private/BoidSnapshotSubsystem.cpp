@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSnapshotSubsystem.h"
+#include "Boid.h"
+#include "Engine/World.h"
+
+void UBoidSnapshotSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	//Before the first tick group, kinematic boids move themselves during their tick
+	//and the rest would read a mix of this frame's and last frame's positions
+	PreActorTickHandle = FWorldDelegates::OnWorldPreActorTick.AddUObject(this, &UBoidSnapshotSubsystem::OnWorldPreActorTick);
+}
+
+void UBoidSnapshotSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldPreActorTick.Remove(PreActorTickHandle);
+	PreActorTickHandle.Reset();
+
+	Super::Deinitialize();
+}
+
+void UBoidSnapshotSubsystem::OnWorldPreActorTick(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime)
+{
+	if (TickedWorld == GetWorld()) {
+		Capture();
+	}
+}
+
+int32 UBoidSnapshotSubsystem::Register(ABoid* Boid)
+{
+	int32 Slot;
+	if (FreeSlots.Num() > 0) {
+		Slot = FreeSlots.Pop(false);
+		Boids[Slot] = Boid;
+	}
+	else {
+		Slot = Boids.Add(Boid);
+		Positions.AddUninitialized();
+		Velocities.AddUninitialized();
+		Serials.Add(0);
+	}
+
+	//Valid right away, a boid registering mid-frame can be seen before the next capture
+	Positions[Slot] = Boid->GetActorLocation();
+	Velocities[Slot] = Boid->GetVelocity();
+
+	return Slot;
+}
+
+void UBoidSnapshotSubsystem::Unregister(int32 Slot)
+{
+	if (!IsValidSlot(Slot)) return;
+
+	//Only boids that had this one as a neighbour need to look their slots up again
+	Boids[Slot] = nullptr;
+	++Serials[Slot];
+	FreeSlots.Add(Slot);
+}
+
+void UBoidSnapshotSubsystem::Capture()
+{
+	for (int32 Slot = 0; Slot < Boids.Num(); ++Slot) {
+		const ABoid* Boid = Boids[Slot];
+		if (Boid == nullptr) continue;
+
+		Positions[Slot] = Boid->GetActorLocation();
+		Velocities[Slot] = Boid->GetVelocity();
+	}
+}
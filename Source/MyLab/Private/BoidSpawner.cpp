@@ -0,0 +1,163 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSpawner.h"
+#include "Boid.h"
+#include "FlockManager.h"
+#include "Engine/World.h"
+#include "HAL/PlatformTime.h"
+
+// Sets default values
+ABoidSpawner::ABoidSpawner()
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = true;
+
+	SetRootComponent(CreateDefaultSubobject<USceneComponent>(TEXT("Root")));
+
+	BoidClass = ABoid::StaticClass();
+	PoolSize = 200;
+	bGrowPool = true;
+	FrameBudgetMs = 1.f;
+	SpawnRadius = 50.f;
+	FlockManager = nullptr;
+}
+
+// Called when the game starts or when spawned
+void ABoidSpawner::BeginPlay()
+{
+	Super::BeginPlay();
+
+	Pool.Reserve(PoolSize);
+	Active.Reserve(PoolSize);
+}
+
+void ABoidSpawner::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	//Boids are spawned into the world, not our level, and would stay behind hidden when we are destroyed or streamed out
+	UWorld* World = GetWorld();
+	if (World != nullptr && !World->bIsTearingDown) {
+		for (ABoid* Boid : Pool) {
+			if (IsValid(Boid)) {
+				Boid->Destroy();
+			}
+		}
+		for (const TWeakObjectPtr<ABoid>& Boid : Active) {
+			if (Boid.IsValid()) {
+				Boid->Destroy();
+			}
+		}
+	}
+
+	Pending.Reset();
+	Pool.Reset();
+	Active.Reset();
+}
+
+// Called every frame
+void ABoidSpawner::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	PruneActive();
+
+	const double Deadline = FPlatformTime::Seconds() + FrameBudgetMs * 0.001;
+	bool bFirst = true;
+
+	//Requests first, the pool is only topped up with what is left of the budget
+	int32 Activated = 0;
+	while (Activated < Pending.Num() && (bFirst || FPlatformTime::Seconds() < Deadline)) {
+		bFirst = false;
+
+		ABoid* Boid = AcquireBoid();
+		if (Boid == nullptr) break;
+
+		ActivateBoid(Boid, Pending[Activated].Location, Pending[Activated].SpawnLocation);
+		Activated++;
+	}
+	if (Activated > 0) {
+		Pending.RemoveAt(0, Activated, false);
+	}
+
+	while (Pool.Num() + Active.Num() < PoolSize && (bFirst || FPlatformTime::Seconds() < Deadline)) {
+		bFirst = false;
+
+		if (AllocateBoid() == nullptr) break;
+	}
+}
+
+void ABoidSpawner::SpawnBoids(int32 Count, FVector SpawnLocation)
+{
+	Pending.Reserve(Pending.Num() + Count);
+
+	for (int32 i = 0; i < Count; ++i) {
+		FPendingBoid& Request = Pending.AddDefaulted_GetRef();
+		Request.Location = SpawnLocation + FMath::VRand() * FMath::FRandRange(0.f, SpawnRadius);
+		Request.SpawnLocation = SpawnLocation;
+	}
+}
+
+void ABoidSpawner::ReleaseBoid(ABoid* Boid)
+{
+	PruneActive();
+
+	if (!IsValid(Boid) || Active.RemoveSingleSwap(Boid, false) == 0) return;
+
+	if (Boid->Manager != nullptr) {
+		Boid->Manager->UnregisterBoid(Boid);
+	}
+
+	Boid->DeactivateToPool();
+	Pool.Add(Boid);
+}
+
+ABoid* ABoidSpawner::AllocateBoid()
+{
+	UWorld* World = GetWorld();
+	if (World == nullptr || BoidClass == nullptr) return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.Owner = this;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	ABoid* Boid = World->SpawnActor<ABoid>(BoidClass, GetActorLocation(), FRotator::ZeroRotator, SpawnParams);
+	if (Boid == nullptr) return nullptr;
+
+	Boid->DeactivateToPool();
+	Pool.Add(Boid);
+
+	return Boid;
+}
+
+ABoid* ABoidSpawner::AcquireBoid()
+{
+	//Boids destroyed by someone else while pooled are skipped
+	while (Pool.Num() > 0) {
+		ABoid* Boid = Pool.Pop(false);
+		if (IsValid(Boid)) return Boid;
+	}
+
+	if (!bGrowPool || AllocateBoid() == nullptr) return nullptr;
+
+	return Pool.Pop(false);
+}
+
+void ABoidSpawner::ActivateBoid(ABoid* Boid, const FVector& Location, const FVector& SpawnLocation)
+{
+	Boid->ActivateFromPool(Location);
+	Active.Add(Boid);
+
+	if (FlockManager != nullptr) {
+		FlockManager->RegisterBoid(Boid, SpawnLocation);
+	}
+	else {
+		Boid->SetSpawnPointLocation(SpawnLocation);
+	}
+}
+
+void ABoidSpawner::PruneActive()
+{
+	Active.RemoveAllSwap([](const TWeakObjectPtr<ABoid>& Boid) { return !Boid.IsValid(); }, false);
+}
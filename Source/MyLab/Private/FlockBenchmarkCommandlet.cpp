@@ -0,0 +1,185 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockBenchmarkCommandlet.h"
+#include "FlockSimulation.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Math/RandomStream.h"
+
+namespace FlockBenchmark
+{
+	struct FResult
+	{
+		int32 Count;
+		int32 Steps;
+		double GridUs;
+		double NeighbourUs;
+		double RulesUs;
+		double IntegrateUs;
+		double OrientUs;
+		double WallUs;
+		double AverageNeighbours;
+		//Fraction of steps that rebuilt the Verlet lists, 1 without them
+		double RebuildRate;
+	};
+
+	//Fills a cube sized so that every flock size sees about the same number of neighbours
+	static void Populate(FFlockSimulation& Simulation, int32 Count, int32 Seed)
+	{
+		const float TargetNeighbours = 20.f;
+		const float Radius = Simulation.Params.SensingRadius;
+		const float VolumePerBoid = (4.f / 3.f) * PI * Radius * Radius * Radius / TargetNeighbours;
+		const float HalfSize = 0.5f * FMath::Pow(Count * VolumePerBoid, 1.f / 3.f);
+
+		Simulation.Reset();
+		Simulation.Params.DistanceFromSpawn = HalfSize;
+
+		FRandomStream Random(Seed);
+		for (int32 Index = 0; Index < Count; ++Index) {
+			const FVector Location(Random.FRandRange(-HalfSize, HalfSize), Random.FRandRange(-HalfSize, HalfSize), Random.FRandRange(-HalfSize, HalfSize));
+			const FVector Velocity = Random.GetUnitVector() * Simulation.Params.MaxSpeed * 0.5f;
+			Simulation.AddBoid(Location, Velocity, FVector::ZeroVector);
+		}
+	}
+
+	static double ToMicroseconds(int64 Cycles)
+	{
+		return FPlatformTime::ToSeconds64(Cycles) * 1000000.0;
+	}
+}
+
+UFlockBenchmarkCommandlet::UFlockBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UFlockBenchmarkCommandlet::Main(const FString& Params)
+{
+	using namespace FlockBenchmark;
+
+	FString CountsString = TEXT("1000,10000,100000");
+	FParse::Value(*Params, TEXT("Counts="), CountsString);
+
+	int32 Steps = 100;
+	FParse::Value(*Params, TEXT("Steps="), Steps);
+	Steps = FMath::Max(Steps, 1);
+
+	int32 Seed = 1;
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("FlockBenchmark.csv");
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	//Same switches as in game, so both code paths can be compared
+	if (FParse::Param(*Params, TEXT("Scalar"))) {
+		IConsoleManager::Get().FindConsoleVariable(TEXT("flock.SimdKernel"))->Set(0);
+	}
+	if (FParse::Param(*Params, TEXT("SingleThread"))) {
+		IConsoleManager::Get().FindConsoleVariable(TEXT("flock.ParallelStep"))->Set(0);
+	}
+
+	//Re-evaluates at most this many boids per step, the others coast
+	int32 TimeSliceBudget = 0;
+	FParse::Value(*Params, TEXT("TimeSliceBudget="), TimeSliceBudget);
+
+	//Topological rules with this many neighbours instead of the sensing radius
+	int32 TopologicalNeighbours = 0;
+	FParse::Value(*Params, TEXT("TopologicalNeighbours="), TopologicalNeighbours);
+
+	//Verlet neighbour lists with this skin, rebuilt only once a boid has moved half of it
+	float VerletSkin = 0.f;
+	FParse::Value(*Params, TEXT("VerletSkin="), VerletSkin);
+
+	//Lockstep maths, run twice or on two machines and compare the logged state hashes
+	const bool bDeterministic = FParse::Param(*Params, TEXT("Deterministic"));
+
+	TArray<FString> CountStrings;
+	CountsString.ParseIntoArray(CountStrings, TEXT(","));
+
+	const float DeltaTime = 1.f / 60.f;
+	const int32 WarmupSteps = 5;
+
+	TArray<FResult> Results;
+	FFlockSimulation Simulation;
+	Simulation.Params.bTimeSlice = TimeSliceBudget > 0;
+	Simulation.Params.TimeSliceBudget = FMath::Max(TimeSliceBudget, 1);
+	Simulation.Params.MaxTimeSlices = 16;
+	Simulation.Params.bTopological = TopologicalNeighbours > 0;
+	Simulation.Params.TopologicalNeighbours = FMath::Max(TopologicalNeighbours, 1);
+	Simulation.Params.bDeterministic = bDeterministic;
+	Simulation.Params.bVerletLists = VerletSkin > 0.f;
+	Simulation.Params.VerletSkin = VerletSkin;
+
+	for (const FString& CountString : CountStrings) {
+		const int32 Count = FCString::Atoi(*CountString);
+		if (Count <= 0) continue;
+
+		Populate(Simulation, Count, Seed);
+
+		Simulation.bCollectTimings = false;
+		for (int32 Step = 0; Step < WarmupSteps; ++Step) {
+			Simulation.Step(DeltaTime);
+		}
+
+		Simulation.bCollectTimings = true;
+		Simulation.Timings.Reset();
+		for (int32 Step = 0; Step < Steps; ++Step) {
+			Simulation.Step(DeltaTime);
+		}
+
+		UE_LOG(LogFlock, Display, TEXT("%7d boids: state hash %08x after %d steps"), Count, Simulation.ComputeStateHash(), WarmupSteps + Steps);
+
+		const FFlockStepTimings& Timings = Simulation.Timings;
+		const double PerBoidStep = 1.0 / (double(Count) * Timings.Steps);
+
+		FResult& Result = Results.AddDefaulted_GetRef();
+		Result.Count = Count;
+		Result.Steps = Timings.Steps;
+		Result.GridUs = ToMicroseconds(Timings.GridCycles) * PerBoidStep;
+		Result.NeighbourUs = ToMicroseconds(Timings.NeighbourCycles) * PerBoidStep;
+		Result.RulesUs = ToMicroseconds(Timings.RulesCycles) * PerBoidStep;
+		Result.IntegrateUs = ToMicroseconds(Timings.IntegrateCycles) * PerBoidStep;
+		Result.OrientUs = ToMicroseconds(Timings.OrientCycles) * PerBoidStep;
+		Result.WallUs = ToMicroseconds(Timings.WallCycles) * PerBoidStep;
+		Result.AverageNeighbours = Timings.GatheredCount > 0 ? double(Timings.NeighbourCount) / Timings.GatheredCount : 0.0;
+		Result.RebuildRate = Simulation.Params.bVerletLists && !Simulation.Params.bTopological ? double(Timings.VerletRebuilds) / Timings.Steps : 1.0;
+
+		UE_LOG(LogFlock, Display, TEXT("%7d boids: %.4f us/boid/step wall (grid %.4f, neighbours %.4f, rules %.4f, integrate %.4f, orient %.4f thread time), %.1f neighbours, grid rebuilt on %.0f%% of steps"),
+			Result.Count, Result.WallUs, Result.GridUs, Result.NeighbourUs, Result.RulesUs, Result.IntegrateUs, Result.OrientUs, Result.AverageNeighbours, Result.RebuildRate * 100.0);
+	}
+
+	//Thread times are summed over workers, wall time is what a frame pays
+	FString Output;
+	if (FPaths::GetExtension(OutputPath).Equals(TEXT("json"), ESearchCase::IgnoreCase)) {
+		Output = TEXT("[\n");
+		for (int32 Index = 0; Index < Results.Num(); ++Index) {
+			const FResult& Result = Results[Index];
+			Output += FString::Printf(TEXT("  {\"boids\": %d, \"steps\": %d, \"grid_us\": %.6f, \"neighbour_us\": %.6f, \"rules_us\": %.6f, \"integrate_us\": %.6f, \"orient_us\": %.6f, \"wall_us\": %.6f, \"avg_neighbours\": %.3f, \"rebuild_rate\": %.4f}%s\n"),
+				Result.Count, Result.Steps, Result.GridUs, Result.NeighbourUs, Result.RulesUs, Result.IntegrateUs, Result.OrientUs, Result.WallUs, Result.AverageNeighbours, Result.RebuildRate,
+				Index + 1 < Results.Num() ? TEXT(",") : TEXT(""));
+		}
+		Output += TEXT("]\n");
+	}
+	else {
+		Output = TEXT("boids,steps,grid_us,neighbour_us,rules_us,integrate_us,orient_us,wall_us,avg_neighbours,rebuild_rate\n");
+		for (const FResult& Result : Results) {
+			Output += FString::Printf(TEXT("%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%.4f\n"),
+				Result.Count, Result.Steps, Result.GridUs, Result.NeighbourUs, Result.RulesUs, Result.IntegrateUs, Result.OrientUs, Result.WallUs, Result.AverageNeighbours, Result.RebuildRate);
+		}
+	}
+
+	if (!FFileHelper::SaveStringToFile(Output, *OutputPath)) {
+		UE_LOG(LogFlock, Error, TEXT("Could not write %s"), *OutputPath);
+		return 1;
+	}
+
+	UE_LOG(LogFlock, Display, TEXT("Flock benchmark written to %s"), *OutputPath);
+	return 0;
+}
@@ -0,0 +1,293 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockCompactSimulation.h"
+#include "FlockSimulation.h"
+#include "FlockFlowField.h"
+#include "FlockKernel.h"
+#include "Async/ParallelFor.h"
+
+namespace FlockCompact
+{
+	//Octahedral mapping, a unit vector folded onto a square, see Cigolle et al. 2014
+	static FORCEINLINE void EncodeDirection(const FVector& Direction, int16& OutU, int16& OutV)
+	{
+		const float L1 = FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + FMath::Abs(Direction.Z);
+		if (L1 <= SMALL_NUMBER) {
+			OutU = OutV = 0;
+			return;
+		}
+
+		float U = Direction.X / L1;
+		float V = Direction.Y / L1;
+		if (Direction.Z < 0.f) {
+			const float FoldedU = (1.f - FMath::Abs(V)) * (U >= 0.f ? 1.f : -1.f);
+			const float FoldedV = (1.f - FMath::Abs(U)) * (V >= 0.f ? 1.f : -1.f);
+			U = FoldedU;
+			V = FoldedV;
+		}
+
+		OutU = (int16)FMath::RoundToInt(FMath::Clamp(U, -1.f, 1.f) * MAX_int16);
+		OutV = (int16)FMath::RoundToInt(FMath::Clamp(V, -1.f, 1.f) * MAX_int16);
+	}
+
+	static FORCEINLINE FVector DecodeDirection(int16 EncodedU, int16 EncodedV)
+	{
+		const float U = float(EncodedU) / MAX_int16;
+		const float V = float(EncodedV) / MAX_int16;
+
+		FVector Direction(U, V, 1.f - FMath::Abs(U) - FMath::Abs(V));
+		if (Direction.Z < 0.f) {
+			Direction.X = (1.f - FMath::Abs(V)) * (U >= 0.f ? 1.f : -1.f);
+			Direction.Y = (1.f - FMath::Abs(U)) * (V >= 0.f ? 1.f : -1.f);
+		}
+
+		return Direction.GetSafeNormal();
+	}
+
+	static FORCEINLINE uint16 EncodeUnit(float Value)
+	{
+		return (uint16)FMath::RoundToInt(FMath::Clamp(Value, 0.f, 1.f) * MAX_uint16);
+	}
+
+	//Rounds up when the value's fraction of a step plus Dither reaches a whole step, Dither 0.5 rounds to the nearest
+	static FORCEINLINE uint16 EncodeUnit(float Value, float Dither)
+	{
+		return (uint16)FMath::Min(FMath::FloorToInt(FMath::Clamp(Value, 0.f, 1.f) * MAX_uint16 + Dither), (int32)MAX_uint16);
+	}
+
+	//Murmur3 finaliser, spreads a boid and step number over all the bits
+	static FORCEINLINE uint32 Mix(uint32 Hash)
+	{
+		Hash ^= Hash >> 16;
+		Hash *= 0x85ebca6bu;
+		Hash ^= Hash >> 13;
+		Hash *= 0xc2b2ae35u;
+		Hash ^= Hash >> 16;
+		return Hash;
+	}
+
+	//Three independent fractions in [0, 1), one per axis
+	static FORCEINLINE FVector MakeDither(uint32 Seed)
+	{
+		const uint32 X = Mix(Seed);
+		const uint32 Y = Mix(X);
+		const uint32 Z = Mix(Y);
+		const float Scale = 1.f / 16777216.f;
+		return FVector((X >> 8) * Scale, (Y >> 8) * Scale, (Z >> 8) * Scale);
+	}
+
+	static FORCEINLINE bool IsInsideUnit(const FVector& Value)
+	{
+		return Value.X >= 0.f && Value.X <= 1.f && Value.Y >= 0.f && Value.Y <= 1.f && Value.Z >= 0.f && Value.Z <= 1.f;
+	}
+
+	static FORCEINLINE float DecodeUnit(uint16 Value)
+	{
+		return float(Value) / MAX_uint16;
+	}
+}
+
+FFlockCompactSimulation::FFlockCompactSimulation()
+{
+	Origin = FVector::ZeroVector;
+	Extent = 10000.f;
+	StepCount = 0;
+	ClampedCount = 0;
+	bWarnedClamped = false;
+}
+
+void FFlockCompactSimulation::Initialize(const FVector& NewOrigin, float NewExtent)
+{
+	Reset();
+	Origin = NewOrigin;
+	Extent = FMath::Max(NewExtent, 1.f);
+	bWarnedClamped = false;
+}
+
+int32 FFlockCompactSimulation::AddBoid(const FVector& Location, const FVector& Velocity, const FVector& SpawnLocation, float MaxSpeed)
+{
+	FFlockCompactBoid Boid;
+	Encode(Boid, Location, Velocity, MaxSpeed);
+	Boid.SpawnIndex = FindOrAddSpawnPoint(SpawnLocation);
+	return Boids.Add(Boid);
+}
+
+void FFlockCompactSimulation::RemoveBoid(int32 Index)
+{
+	check(Boids.IsValidIndex(Index));
+	Boids.RemoveAtSwap(Index, 1, false);
+}
+
+void FFlockCompactSimulation::Reset()
+{
+	Boids.Reset();
+	SpawnPoints.Reset();
+	SpawnPointIndices.Reset();
+	Positions.Empty();
+	Velocities.Empty();
+	Grid.Empty();
+	StepCount = 0;
+	ClampedCount = 0;
+}
+
+uint16 FFlockCompactSimulation::FindOrAddSpawnPoint(const FVector& SpawnLocation)
+{
+	if (const uint16* Found = SpawnPointIndices.Find(SpawnLocation)) return *Found;
+
+	//Out of indices, the boid shares the nearest spawn point instead
+	if (SpawnPoints.Num() > MAX_uint16) {
+		int32 Nearest = 0;
+		for (int32 Index = 1; Index < SpawnPoints.Num(); ++Index) {
+			if (FVector::DistSquared(SpawnPoints[Index], SpawnLocation) < FVector::DistSquared(SpawnPoints[Nearest], SpawnLocation)) {
+				Nearest = Index;
+			}
+		}
+		return (uint16)Nearest;
+	}
+
+	const uint16 Index = (uint16)SpawnPoints.Add(SpawnLocation);
+	SpawnPointIndices.Add(SpawnLocation, Index);
+	return Index;
+}
+
+bool FFlockCompactSimulation::Encode(FFlockCompactBoid& Boid, const FVector& Location, const FVector& Velocity, float MaxSpeed, const FVector& Dither) const
+{
+	using namespace FlockCompact;
+
+	const FVector Local = (Location - Origin) / (2.f * Extent) + FVector(0.5f);
+	Boid.X = EncodeUnit(Local.X, Dither.X);
+	Boid.Y = EncodeUnit(Local.Y, Dither.Y);
+	Boid.Z = EncodeUnit(Local.Z, Dither.Z);
+
+	float Speed;
+	FVector Direction;
+	Velocity.ToDirectionAndLength(Direction, Speed);
+	EncodeDirection(Direction, Boid.DirectionU, Boid.DirectionV);
+	Boid.Speed = MaxSpeed > 0.f ? EncodeUnit(Speed / MaxSpeed) : 0;
+
+	return IsInsideUnit(Local);
+}
+
+FVector FFlockCompactSimulation::GetPosition(int32 Index) const
+{
+	using namespace FlockCompact;
+
+	const FFlockCompactBoid& Boid = Boids[Index];
+	const FVector Local(DecodeUnit(Boid.X), DecodeUnit(Boid.Y), DecodeUnit(Boid.Z));
+	return Origin + (Local - FVector(0.5f)) * (2.f * Extent);
+}
+
+FVector FFlockCompactSimulation::GetDirection(int32 Index) const
+{
+	const FFlockCompactBoid& Boid = Boids[Index];
+	return FlockCompact::DecodeDirection(Boid.DirectionU, Boid.DirectionV);
+}
+
+FVector FFlockCompactSimulation::GetVelocity(int32 Index, float MaxSpeed) const
+{
+	return GetDirection(Index) * FlockCompact::DecodeUnit(Boids[Index].Speed) * MaxSpeed;
+}
+
+FVector FFlockCompactSimulation::GlobalSteering(int32 Index, const FFlockParams& Params, const FFlockFlowField* FlowField) const
+{
+	const FVector& Position = Positions[Index];
+	const FVector& SpawnLocation = SpawnPoints[Boids[Index].SpawnIndex];
+
+	//Same as FFlockSimulation::MoveTowardOrigin, always per boid
+	FVector Steering = FVector::ZeroVector;
+	const FVector ToSpawn = SpawnLocation - Position;
+	if (ToSpawn.SizeSquared() > Params.DistanceFromSpawn * Params.DistanceFromSpawn) {
+		Steering += ToSpawn * Params.ReturnRate;
+	}
+
+	FVector Flow;
+	if (FlowField != nullptr && FlowField->Sample(Position, Flow)) {
+		return Steering + Flow;
+	}
+
+	//Same as FFlockSimulation::OrthonormalVelocity
+
+	FVector Vortex = FlockMath::SafeNormal(SpawnLocation - Velocities[Index]);
+	Vortex = Params.VortexClockwise ? FVector(Vortex.Y, -Vortex.X, Vortex.Z) : FVector(-Vortex.Y, Vortex.X, Vortex.Z);
+	Steering += FlockMath::SafeNormal(Vortex) * Params.VortexRate;
+
+	return Steering;
+}
+
+void FFlockCompactSimulation::Step(float DeltaTime, const FFlockParams& Params, const FFlockFlowField* FlowField)
+{
+	const int32 Count = Num();
+	if (Count == 0 || DeltaTime <= 0.f) return;
+
+	const float MaxSpeed = Params.MaxSpeed;
+	const float Damping = 1.f / (1.f + Params.LinearDamping * DeltaTime);
+	const int32 NumChunks = FMath::DivideAndRoundUp(Count, StepChunkSize);
+
+	//Full floats only for the length of the step, the stored state stays quantised
+	Positions.SetNumUninitialized(Count, false);
+	Velocities.SetNumUninitialized(Count, false);
+
+	ParallelFor(NumChunks, [this, Count, MaxSpeed](int32 Chunk) {
+		const int32 First = Chunk * StepChunkSize;
+		const int32 Last = FMath::Min(First + StepChunkSize, Count);
+
+		for (int32 Index = First; Index < Last; ++Index) {
+			Positions[Index] = GetPosition(Index);
+			Velocities[Index] = GetVelocity(Index, MaxSpeed);
+		}
+	});
+
+	Grid.Build(Positions, FMath::Max(Params.SensingRadius, 1.f));
+
+	int32 Clamped = 0;
+	const uint32 StepSeed = FlockCompact::Mix(++StepCount);
+
+	//Reads only the decoded arrays, so every boid can be quantised back in place
+	ParallelFor(NumChunks, [this, Count, DeltaTime, &Params, FlowField, MaxSpeed, Damping, StepSeed, &Clamped](int32 Chunk) {
+		TArray<int32> Neighbours;
+		FFlockNeighbourBuffer Packed;
+		int32 ChunkClamped = 0;
+
+		const int32 First = Chunk * StepChunkSize;
+		const int32 Last = FMath::Min(First + StepChunkSize, Count);
+
+		for (int32 Index = First; Index < Last; ++Index) {
+			const FVector& Position = Positions[Index];
+
+			Neighbours.Reset();
+			Grid.Query(Position, Params.SensingRadius, Positions, Neighbours, Index);
+			Packed.Pack(Neighbours, Positions, Velocities);
+
+			//Same composition as FFlockSimulation::ComputeSteering, without obstacles or species
+			FVector Push;
+			const FVector Rules = FFlockKernel::ComputeRules(Position, Packed, Params, Push);
+			const FVector Steering = FlockMath::SafeNormal(FlockMath::SafeNormal(GlobalSteering(Index, Params, FlowField)) + Rules);
+
+			//As FFlockSimulation::IntegrateBoid without time slicing
+			FVector NewVelocity = (Velocities[Index] + (Steering * Params.SpeedScale + Push * Params.ContactStiffness) * DeltaTime) * Damping;
+			NewVelocity = FlockMath::ClampedToMaxSize(NewVelocity, MaxSpeed);
+
+			//Rounding to the nearest step would undo any move under half a step, and freeze slow boids on that axis
+			const FVector Dither = FlockCompact::MakeDither(StepSeed ^ uint32(Index));
+			if (!Encode(Boids[Index], Position + NewVelocity * DeltaTime, NewVelocity, MaxSpeed, Dither)) {
+				++ChunkClamped;
+			}
+		}
+
+		if (ChunkClamped > 0) {
+			FPlatformAtomics::InterlockedAdd(&Clamped, ChunkClamped);
+		}
+	});
+
+	//Several times the size of the quantised flock, not worth keeping around between steps
+	Positions.Empty();
+	Velocities.Empty();
+	Grid.Empty();
+
+	ClampedCount = Clamped;
+	if (ClampedCount > 0 && !bWarnedClamped) {
+		UE_LOG(LogFlock, Warning, TEXT("%d compact boids reached the edge of their box and were clamped to it, raise CompactExtent above %.0f"), ClampedCount, Extent);
+		bWarnedClamped = true;
+	}
+}
@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockFlowField.h"
+#include "FlockSimulation.h"
+#include "Async/ParallelFor.h"
+
+FFlockFlowElement::FFlockFlowElement()
+{
+	Type = EFlockFlowElementType::Vortex;
+	Location = FVector::ZeroVector;
+	Axis = FVector::UpVector;
+	Length = 0.f;
+	Strength = 0.1f;
+	Radius = 0.f;
+	Inflow = 0.f;
+	Lift = 0.f;
+	bClockwise = true;
+}
+
+FVector FFlockFlowElement::Evaluate(const FVector& Point) const
+{
+	const FVector Direction = FlockMath::SafeNormal(Axis);
+
+	switch (Type) {
+	case EFlockFlowElementType::Vortex: {
+		if (Direction.IsZero()) return FVector::ZeroVector;
+
+		//Closest point of the axis, clamped to its ends when it has a length
+		float Along = FVector::DotProduct(Point - Location, Direction);
+		if (Length > 0.f) {
+			Along = FMath::Clamp(Along, 0.f, Length);
+		}
+		const FVector Radial = Point - (Location + Direction * Along);
+		const float Distance = Radial.Size();
+		if (Distance < KINDA_SMALL_NUMBER) return Direction * (Strength * Lift);
+
+		//Solid body rotation inside the core, 1/r outside
+		const float Swirl = Strength * (Radius > 0.f ? (Distance < Radius ? Distance / Radius : Radius / Distance) : 1.f);
+
+		const FVector RadialDirection = Radial / Distance;
+		FVector Tangent = FVector::CrossProduct(Direction, RadialDirection);
+		if (bClockwise) {
+			Tangent = -Tangent;
+		}
+
+		return (Tangent - RadialDirection * Inflow + Direction * Lift) * Swirl;
+	}
+
+	case EFlockFlowElementType::Attractor: {
+		//Same as FFlockSimulation::MoveTowardOrigin, grows with the distance so boids can't get away
+		const FVector ToTarget = Location - Point;
+		return ToTarget.SizeSquared() > Radius * Radius ? ToTarget * Strength : FVector::ZeroVector;
+	}
+
+	case EFlockFlowElementType::Wind:
+		return Direction * Strength;
+	}
+
+	return FVector::ZeroVector;
+}
+
+FFlockFlowField::FFlockFlowField()
+{
+	Bounds = FBox(ForceInit);
+	CellSize = 100.f;
+	Resolution = FIntVector::ZeroValue;
+}
+
+void FFlockFlowField::Build(const FBox& InBounds, float InCellSize, const TArray<FFlockFlowElement>& Elements)
+{
+	Build(InBounds, InCellSize, [&Elements](const FVector& Point) {
+		FVector Flow = FVector::ZeroVector;
+		for (const FFlockFlowElement& Element : Elements) {
+			Flow += Element.Evaluate(Point);
+		}
+		return Flow;
+	});
+}
+
+void FFlockFlowField::Build(const FBox& InBounds, float InCellSize, TFunctionRef<FVector(const FVector&)> Evaluate)
+{
+	Reset();
+	if (!InBounds.IsValid || InCellSize <= 0.f) return;
+
+	//Keep the grid to a cache friendly size whatever the bounds
+	const FVector Size = InBounds.GetSize();
+	CellSize = FMath::Max(InCellSize, Size.GetMax() / (MaxResolution - 1));
+
+	Resolution = FIntVector(
+		FMath::Max(FMath::CeilToInt(Size.X / CellSize), 1) + 1,
+		FMath::Max(FMath::CeilToInt(Size.Y / CellSize), 1) + 1,
+		FMath::Max(FMath::CeilToInt(Size.Z / CellSize), 1) + 1);
+	Bounds = FBox(InBounds.Min, InBounds.Min + FVector(Resolution - FIntVector(1)) * CellSize);
+
+	Vectors.SetNumUninitialized(Resolution.X * Resolution.Y * Resolution.Z);
+
+	//One layer per task, every point is independent
+	ParallelFor(Resolution.Z, [this, &Evaluate](int32 Z) {
+		for (int32 Y = 0; Y < Resolution.Y; ++Y) {
+			for (int32 X = 0; X < Resolution.X; ++X) {
+				Vectors[GetPointIndex(X, Y, Z)] = Evaluate(Bounds.Min + FVector(X, Y, Z) * CellSize);
+			}
+		}
+	});
+}
+
+void FFlockFlowField::Reset()
+{
+	Vectors.Reset();
+	Resolution = FIntVector::ZeroValue;
+	Bounds = FBox(ForceInit);
+}
+
+bool FFlockFlowField::Sample(const FVector& Location, FVector& OutVector) const
+{
+	OutVector = FVector::ZeroVector;
+	if (!IsValid() || !Bounds.IsInside(Location)) return false;
+
+	//Samples sit on the cell corners
+	const FVector Local = (Location - Bounds.Min) / CellSize;
+
+	const int32 X0 = FMath::Clamp(FMath::FloorToInt(Local.X), 0, Resolution.X - 2);
+	const int32 Y0 = FMath::Clamp(FMath::FloorToInt(Local.Y), 0, Resolution.Y - 2);
+	const int32 Z0 = FMath::Clamp(FMath::FloorToInt(Local.Z), 0, Resolution.Z - 2);
+
+	const float TX = FMath::Clamp(Local.X - X0, 0.f, 1.f);
+	const float TY = FMath::Clamp(Local.Y - Y0, 0.f, 1.f);
+	const float TZ = FMath::Clamp(Local.Z - Z0, 0.f, 1.f);
+
+	//Neighbouring corners along X are next to each other in memory
+	const FVector* Row00 = &Vectors[GetPointIndex(X0, Y0, Z0)];
+	const FVector* Row10 = &Vectors[GetPointIndex(X0, Y0 + 1, Z0)];
+	const FVector* Row01 = &Vectors[GetPointIndex(X0, Y0, Z0 + 1)];
+	const FVector* Row11 = &Vectors[GetPointIndex(X0, Y0 + 1, Z0 + 1)];
+
+	const FVector V0 = FMath::Lerp(FMath::Lerp(Row00[0], Row00[1], TX), FMath::Lerp(Row10[0], Row10[1], TX), TY);
+	const FVector V1 = FMath::Lerp(FMath::Lerp(Row01[0], Row01[1], TX), FMath::Lerp(Row11[0], Row11[1], TX), TY);
+
+	OutVector = FMath::Lerp(V0, V1, TZ);
+	return true;
+}
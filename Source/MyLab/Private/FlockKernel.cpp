@@ -0,0 +1,143 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockKernel.h"
+#include "FlockSimulation.h"
+#include "Math/VectorRegister.h"
+
+void FFlockNeighbourBuffer::Pack(const TArray<int32>& Neighbours, const TArray<FVector>& Positions, const TArray<FVector>& Velocities)
+{
+	Count = Neighbours.Num();
+	const int32 Padded = Align(Count, 4);
+
+	PX.SetNumUninitialized(Padded, false);
+	PY.SetNumUninitialized(Padded, false);
+	PZ.SetNumUninitialized(Padded, false);
+	VX.SetNumUninitialized(Padded, false);
+	VY.SetNumUninitialized(Padded, false);
+	VZ.SetNumUninitialized(Padded, false);
+
+	for (int32 Slot = 0; Slot < Count; ++Slot) {
+		const FVector& Position = Positions[Neighbours[Slot]];
+		const FVector& Velocity = Velocities[Neighbours[Slot]];
+		PX[Slot] = Position.X;
+		PY[Slot] = Position.Y;
+		PZ[Slot] = Position.Z;
+		VX[Slot] = Velocity.X;
+		VY[Slot] = Velocity.Y;
+		VZ[Slot] = Velocity.Z;
+	}
+
+	//Padding lanes are masked out of the position sums, zero velocity drops out of alignment by itself
+	for (int32 Slot = Count; Slot < Padded; ++Slot) {
+		PX[Slot] = PY[Slot] = PZ[Slot] = 0.f;
+		VX[Slot] = VY[Slot] = VZ[Slot] = 0.f;
+	}
+}
+
+static FORCEINLINE float HorizontalSum(const VectorRegister& Vec)
+{
+	float Lanes[4];
+	VectorStore(Vec, Lanes);
+	return (Lanes[0] + Lanes[1]) + (Lanes[2] + Lanes[3]);
+}
+
+FVector FFlockKernel::ComputeRules(const FVector& Location, const FFlockNeighbourBuffer& Neighbours, const FFlockParams& Params, FVector& OutContactPush)
+{
+	OutContactPush = FVector::ZeroVector;
+
+	const int32 Count = Neighbours.Num();
+	if (Count == 0) return FVector::ZeroVector;
+
+	const VectorRegister Zero = VectorZero();
+	const VectorRegister One = VectorOne();
+	const VectorRegister LaneIndex = MakeVectorRegister(0.f, 1.f, 2.f, 3.f);
+	//GetSafeNormal treats anything under this squared length as zero
+	const VectorRegister Tiny = VectorSetFloat1(SMALL_NUMBER);
+	const VectorRegister SeparationLengthSquared = VectorSetFloat1(Params.SeparationLength * Params.SeparationLength);
+	const VectorRegister SeparationRate = VectorSetFloat1(Params.SeparationRate);
+	const bool bContacts = Params.bKinematic && Params.ContactRadius > 0.f;
+	const VectorRegister ContactDistance = VectorSetFloat1(2.f * Params.ContactRadius);
+	const VectorRegister ContactDistanceSquared = VectorMultiply(ContactDistance, ContactDistance);
+
+	const VectorRegister SelfX = VectorSetFloat1(Location.X);
+	const VectorRegister SelfY = VectorSetFloat1(Location.Y);
+	const VectorRegister SelfZ = VectorSetFloat1(Location.Z);
+
+	VectorRegister SumPX = Zero, SumPY = Zero, SumPZ = Zero;
+	VectorRegister SumSX = Zero, SumSY = Zero, SumSZ = Zero;
+	VectorRegister SumVX = Zero, SumVY = Zero, SumVZ = Zero;
+	VectorRegister SeparationCount = Zero;
+	VectorRegister SumCX = Zero, SumCY = Zero, SumCZ = Zero;
+
+	for (int32 Base = 0; Base < Count; Base += 4) {
+		const VectorRegister Valid = VectorCompareGT(VectorSetFloat1(float(Count - Base)), LaneIndex);
+
+		const VectorRegister PX = VectorLoad(&Neighbours.PX[Base]);
+		const VectorRegister PY = VectorLoad(&Neighbours.PY[Base]);
+		const VectorRegister PZ = VectorLoad(&Neighbours.PZ[Base]);
+		const VectorRegister VX = VectorLoad(&Neighbours.VX[Base]);
+		const VectorRegister VY = VectorLoad(&Neighbours.VY[Base]);
+		const VectorRegister VZ = VectorLoad(&Neighbours.VZ[Base]);
+
+		//Cohesion, plain position sum
+		SumPX = VectorAdd(SumPX, VectorBitwiseAnd(PX, Valid));
+		SumPY = VectorAdd(SumPY, VectorBitwiseAnd(PY, Valid));
+		SumPZ = VectorAdd(SumPZ, VectorBitwiseAnd(PZ, Valid));
+
+		//Separation, normal * (Rate / Distance) == Offset * Rate / Distance^2
+		const VectorRegister DX = VectorSubtract(SelfX, PX);
+		const VectorRegister DY = VectorSubtract(SelfY, PY);
+		const VectorRegister DZ = VectorSubtract(SelfZ, PZ);
+		const VectorRegister DistanceSquared = VectorMultiplyAdd(DZ, DZ, VectorMultiplyAdd(DY, DY, VectorMultiply(DX, DX)));
+
+		const VectorRegister InRange = VectorBitwiseAnd(Valid, VectorCompareGT(SeparationLengthSquared, DistanceSquared));
+		const VectorRegister NonZero = VectorCompareGT(DistanceSquared, Tiny);
+		const VectorRegister Weight = VectorBitwiseAnd(VectorBitwiseAnd(InRange, NonZero), VectorMultiply(SeparationRate, VectorReciprocalAccurate(VectorMax(DistanceSquared, Tiny))));
+
+		SumSX = VectorMultiplyAdd(DX, Weight, SumSX);
+		SumSY = VectorMultiplyAdd(DY, Weight, SumSY);
+		SumSZ = VectorMultiplyAdd(DZ, Weight, SumSZ);
+		SeparationCount = VectorAdd(SeparationCount, VectorBitwiseAnd(InRange, One));
+
+		//Soft contacts, push out by the penetration depth of the two spheres
+		if (bContacts) {
+			const VectorRegister Touching = VectorBitwiseAnd(VectorBitwiseAnd(Valid, NonZero), VectorCompareGT(ContactDistanceSquared, DistanceSquared));
+			const VectorRegister InvDistance = VectorReciprocalSqrtAccurate(VectorMax(DistanceSquared, Tiny));
+			const VectorRegister Penetration = VectorSubtract(ContactDistance, VectorMultiply(DistanceSquared, InvDistance));
+			const VectorRegister PushWeight = VectorBitwiseAnd(Touching, VectorMultiply(Penetration, InvDistance));
+
+			SumCX = VectorMultiplyAdd(DX, PushWeight, SumCX);
+			SumCY = VectorMultiplyAdd(DY, PushWeight, SumCY);
+			SumCZ = VectorMultiplyAdd(DZ, PushWeight, SumCZ);
+		}
+
+		//Alignment, sum of normalized velocities
+		const VectorRegister SpeedSquared = VectorMultiplyAdd(VZ, VZ, VectorMultiplyAdd(VY, VY, VectorMultiply(VX, VX)));
+		const VectorRegister InvSpeed = VectorBitwiseAnd(VectorCompareGT(SpeedSquared, Tiny), VectorReciprocalSqrtAccurate(VectorMax(SpeedSquared, Tiny)));
+
+		SumVX = VectorMultiplyAdd(VX, InvSpeed, SumVX);
+		SumVY = VectorMultiplyAdd(VY, InvSpeed, SumVY);
+		SumVZ = VectorMultiplyAdd(VZ, InvSpeed, SumVZ);
+	}
+
+	const FVector AveragePosition = FVector(HorizontalSum(SumPX), HorizontalSum(SumPY), HorizontalSum(SumPZ)) / Count;
+	const FVector Cohesion = (AveragePosition - Location).GetSafeNormal() * Params.CohesionRate;
+
+	//Averages are kept even though they don't change the direction, GetSafeNormal's threshold depends on the length
+	FVector Separation = FVector::ZeroVector;
+	const float SeparationCounter = HorizontalSum(SeparationCount);
+	if (SeparationCounter > 0.f) {
+		Separation = FVector(HorizontalSum(SumSX), HorizontalSum(SumSY), HorizontalSum(SumSZ)) / SeparationCounter;
+	}
+	Separation = Separation.GetSafeNormal() * Params.SeparationRate;
+
+	const FVector AverageVelocity = FVector(HorizontalSum(SumVX), HorizontalSum(SumVY), HorizontalSum(SumVZ)) / Count;
+	const FVector Alignment = AverageVelocity.GetSafeNormal() * Params.AlignmentRate;
+
+	if (bContacts) {
+		OutContactPush = FVector(HorizontalSum(SumCX), HorizontalSum(SumCY), HorizontalSum(SumCZ));
+	}
+
+	return Cohesion + Separation + Alignment;
+}
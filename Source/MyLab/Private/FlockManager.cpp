@@ -0,0 +1,835 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockManager.h"
+#include "Boid.h"
+#include "FlockObstacleField.h"
+#include "FlockWarmupState.h"
+#include "FlockPlaybackClip.h"
+#include "FlockStats.h"
+#include "FlockTornadoComponent.h"
+#include "Components/SceneComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Camera/PlayerCameraManager.h"
+#include "GameFramework/GameStateBase.h"
+#include "Net/UnrealNetwork.h"
+#include "HAL/IConsoleManager.h"
+#include "Algo/BinarySearch.h"
+
+static TAutoConsoleVariable<int32> CVarFlockLogStateHash(
+	TEXT("flock.LogStateHash"),
+	0,
+	TEXT("When set, lockstep flocks log their state hash after every step. Diff the logs of two machines to find the step they split at."),
+	ECVF_Default);
+
+// Sets default values
+AFlockManager::AFlockManager()
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = true;
+
+	//Always replicated so clients know they aren't the authority, only bReplicateFlock sends anything
+	bReplicates = true;
+
+	SetRootComponent(CreateDefaultSubobject<USceneComponent>(TEXT("Root")));
+
+	//Plain instanced mesh rather than a hierarchical one, every instance moves every frame
+	//and a HISM would rebuild its cluster tree each time
+	InstancedMesh = CreateDefaultSubobject<UInstancedStaticMeshComponent>(TEXT("InstancedMesh"));
+	InstancedMesh->SetupAttachment(GetRootComponent());
+	InstancedMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	InstancedMesh->SetGenerateOverlapEvents(false);
+	InstancedMesh->SetCanEverAffectNavigation(false);
+
+	BoidClass = ABoid::StaticClass();
+	bUseInstancedRendering = false;
+	bCompactStorage = false;
+	CompactExtent = 10000.f;
+	OrientThreshold = 2.f;
+	InitialBoidCount = 0;
+	SpawnRadius = 50.f;
+
+	bAvoidObstacles = false;
+	TraceChannel = ECC_WorldStatic;
+	MaxTracesPerFrame = 64;
+	MinRetraceInterval = 0.05f;
+	MaxRetraceInterval = 1.f;
+
+	ObstacleField = nullptr;
+	BakeExtent = FVector(2000.f, 2000.f, 1000.f);
+	BakeVoxelSize = 50.f;
+
+	WarmupState = nullptr;
+	WarmupSeconds = 10.f;
+	WarmupStepRate = 30.f;
+
+	PlaybackClip = nullptr;
+	PlaybackTimeOffset = 0.f;
+	PlaybackRate = 1.f;
+	RecordDuration = 20.f;
+	RecordFrameRate = 10.f;
+	RecordBlendSeconds = 2.f;
+	PlaybackTime = 0.f;
+
+	bReplicateFlock = false;
+	NetBytesPerSecond = 4096;
+	MinNetSendRate = 2.f;
+	MaxNetSendRate = 10.f;
+	NetRelevantDistance = 10000.f;
+	NetSmoothingTime = 0.3f;
+	NetSendTimer = 0.f;
+	NetNextIndex = 0;
+
+	bUseFlowField = false;
+	FlowFieldExtent = FVector(3000.f, 3000.f, 1500.f);
+	FlowFieldCellSize = 200.f;
+	NodeVortex.Radius = 500.f;
+	NodeVortex.Inflow = 0.2f;
+	NodeVortex.Lift = 0.3f;
+	FlowFieldRebuildInterval = 0.f;
+	FlowFieldTimer = 0.f;
+
+	bLockstep = false;
+	LockstepStepRate = 30.f;
+	LockstepSeed = 0;
+	MaxLockstepStepsPerFrame = 4;
+	LockstepAccumulator = 0.f;
+	LockstepStep = 0;
+}
+
+void AFlockManager::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AFlockManager, NetSnapshot);
+}
+
+// Called when the game starts or when spawned
+void AFlockManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	Simulation.Params = Params;
+	CompactSimulation.Initialize(GetActorLocation(), CompactExtent);
+
+	LockstepRandom.Initialize(LockstepSeed);
+	RebuildFlowField();
+
+	//Snapshots are forced out when they are built, this only caps how often the actor is looked at
+	NetUpdateFrequency = bReplicateFlock ? MaxNetSendRate : 1.f;
+
+	//A played back flock has no simulated boids at all
+	PlaybackTime = PlaybackTimeOffset;
+	if (PlaybackClip != nullptr && PlaybackClip->IsValid()) return;
+
+	//Clients get their boids from the server's snapshots
+	if (bReplicateFlock && !bLockstep && !HasAuthority() && !(bCompactStorage && bUseInstancedRendering)) return;
+
+	if (WarmupState != nullptr && WarmupState->IsValid()) {
+		SpawnFromWarmupState();
+	}
+	else if (InitialBoidCount > 0) {
+		SpawnBoids(InitialBoidCount, GetActorLocation());
+	}
+}
+
+void AFlockManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	//Views may outlive us during level teardown, make sure they don't call back
+	for (ABoid* Boid : Views) {
+		if (Boid != nullptr) {
+			Boid->DetachFromFlock();
+		}
+	}
+	Views.Reset();
+	Simulation.Reset();
+	CompactSimulation.Reset();
+	ObstacleTracer.Reset();
+}
+
+// Called every frame
+void AFlockManager::Tick(float DeltaTime)
+{
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockTick);
+
+	Super::Tick(DeltaTime);
+
+	if (PlaybackClip != nullptr && PlaybackClip->IsValid()) {
+		//Kept within the loop so the time doesn't lose precision over a long session
+		PlaybackTime = FMath::Fmod(PlaybackTime + DeltaTime * PlaybackRate, PlaybackClip->GetDuration());
+		PushPlaybackInstances();
+		return;
+	}
+
+	//Lockstep machines would rebuild on different steps, their field only changes through RebuildFlowField
+	if (bUseFlowField && FlowFieldRebuildInterval > 0.f && !bLockstep) {
+		FlowFieldTimer += DeltaTime;
+		if (FlowFieldTimer >= FlowFieldRebuildInterval) {
+			FlowFieldTimer = 0.f;
+			RebuildFlowField();
+		}
+	}
+	const FFlockFlowField* Flow = FlowField.IsValid() ? &FlowField : nullptr;
+
+	if (bCompactStorage && bUseInstancedRendering) {
+		CompactSimulation.Step(DeltaTime, Params, Flow);
+		PushCompactInstances();
+		return;
+	}
+
+	//Params can be edited from Blueprint at any time
+	Simulation.Params = Params;
+	Simulation.Species = Species;
+	Simulation.ObstacleField = (ObstacleField != nullptr && ObstacleField->IsValid()) ? ObstacleField : nullptr;
+	Simulation.FlowField = Flow;
+
+	//Lockstep runs on its own fixed clock, with nothing that differs between machines
+	if (bLockstep) {
+		TickLockstep(DeltaTime);
+	}
+	else {
+		//Last frame's traces are read before stepping, new ones are issued from the new positions
+		if (bAvoidObstacles) {
+			ObstacleTracer.ObjectType = TraceChannel;
+			ObstacleTracer.MaxTracesPerFrame = MaxTracesPerFrame;
+			ObstacleTracer.MinRetraceInterval = MinRetraceInterval;
+			ObstacleTracer.MaxRetraceInterval = MaxRetraceInterval;
+
+			FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockObstacleTraces);
+			FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(FlockObstacleTrace), false, this);
+			ObstacleTracer.Update(GetWorld(), Simulation, QueryParams);
+		}
+		else if (ObstacleTracer.IsTracking()) {
+			//Switched off at runtime, drop the traces in flight and the steering from the last ones
+			ObstacleTracer.Reset();
+			for (FVector& Avoidance : Simulation.Avoidance) {
+				Avoidance = FVector::ZeroVector;
+			}
+		}
+
+		if (Params.bEnableLOD) {
+			UpdateLODViews();
+		}
+		else {
+			Simulation.LODViews.Reset();
+		}
+
+		Simulation.Step(DeltaTime);
+
+		if (bReplicateFlock) {
+			if (!HasAuthority()) {
+				Simulation.DecayCorrections(DeltaTime, NetSmoothingTime);
+			}
+			else if (GetNetMode() != NM_Standalone) {
+				UpdateNetSnapshot(DeltaTime);
+			}
+		}
+	}
+
+	if (bUseInstancedRendering) {
+		PushInstances();
+	}
+	else {
+		PushViews();
+	}
+}
+
+void AFlockManager::TickLockstep(float DeltaTime)
+{
+	Simulation.Params.bDeterministic = true;
+	Simulation.LODViews.Reset();
+
+	const float StepTime = 1.f / FMath::Max(LockstepStepRate, 1.f);
+
+	//Frame time only decides how many steps run, never what a step does
+	LockstepAccumulator = FMath::Min(LockstepAccumulator + DeltaTime, StepTime * FMath::Max(MaxLockstepStepsPerFrame, 1));
+	while (LockstepAccumulator >= StepTime) {
+		LockstepAccumulator -= StepTime;
+
+		ApplyLockstepEvents();
+		Simulation.Step(StepTime);
+		++LockstepStep;
+
+		if (CVarFlockLogStateHash.GetValueOnGameThread() != 0) {
+			UE_LOG(LogFlock, Log, TEXT("%s: step %d, %d boids, hash %08x"), *GetName(), LockstepStep, Simulation.Num(), Simulation.ComputeStateHash());
+		}
+	}
+
+	//Views are drawn ahead by the time already gone toward the next step, so they move every frame
+	Simulation.RenderLead = LockstepAccumulator;
+}
+
+void AFlockManager::SpawnBoidsAtStep(int32 Step, int32 Count, FVector SpawnLocation, int32 SpeciesIndex)
+{
+	FFlockLockstepEvent Event;
+	Event.Type = FFlockLockstepEvent::EType::SpawnBoids;
+	Event.Step = Step;
+	Event.Index = SpeciesIndex;
+	Event.Count = Count;
+	Event.Location = SpawnLocation;
+	ScheduleLockstepEvent(Event);
+}
+
+void AFlockManager::SetBoidSpawnLocationAtStep(int32 Step, int32 Index, FVector NewSpawnLocation)
+{
+	FFlockLockstepEvent Event;
+	Event.Type = FFlockLockstepEvent::EType::SetSpawnLocation;
+	Event.Step = Step;
+	Event.Index = Index;
+	Event.Count = 0;
+	Event.Location = NewSpawnLocation;
+	ScheduleLockstepEvent(Event);
+}
+
+void AFlockManager::RemoveBoidAtStep(int32 Step, int32 Index)
+{
+	FFlockLockstepEvent Event;
+	Event.Type = FFlockLockstepEvent::EType::RemoveBoid;
+	Event.Step = Step;
+	Event.Index = Index;
+	Event.Count = 0;
+	Event.Location = FVector::ZeroVector;
+	ScheduleLockstepEvent(Event);
+}
+
+void AFlockManager::ScheduleLockstepEvent(const FFlockLockstepEvent& Event)
+{
+	if (Event.Step < LockstepStep) {
+		UE_LOG(LogFlock, Warning, TEXT("%s: lockstep event for step %d scheduled at step %d, this machine's flock will diverge"), *GetName(), Event.Step, LockstepStep);
+	}
+
+	//After every event of the same step, so they run in the order they were scheduled
+	const int32 Insert = Algo::UpperBoundBy(LockstepEvents, Event.Step, &FFlockLockstepEvent::Step);
+	LockstepEvents.Insert(Event, Insert);
+}
+
+void AFlockManager::ApplyLockstepEvents()
+{
+	int32 Applied = 0;
+	for (; Applied < LockstepEvents.Num() && LockstepEvents[Applied].Step <= LockstepStep; ++Applied) {
+		const FFlockLockstepEvent& Event = LockstepEvents[Applied];
+
+		switch (Event.Type) {
+		case FFlockLockstepEvent::EType::SpawnBoids:
+			SpawnBoids(Event.Count, Event.Location, Event.Index);
+			break;
+
+		case FFlockLockstepEvent::EType::SetSpawnLocation:
+			SetBoidSpawnLocation(Event.Index, Event.Location);
+			break;
+
+		case FFlockLockstepEvent::EType::RemoveBoid: {
+			if (!Views.IsValidIndex(Event.Index)) break;
+
+			ABoid* Boid = Views[Event.Index];
+			if (Boid != nullptr) {
+				UnregisterBoid(Boid);
+				Boid->Destroy();
+			}
+			else {
+				//Same as UnregisterBoid, the last boid was moved into the freed slot
+				RemoveBoidAt(Event.Index);
+				if (Views.IsValidIndex(Event.Index) && Views[Event.Index] != nullptr) {
+					Views[Event.Index]->FlockIndex = Event.Index;
+				}
+			}
+			break;
+		}
+		}
+	}
+
+	LockstepEvents.RemoveAt(0, Applied, false);
+}
+
+FVector AFlockManager::RandomSpawnOffset()
+{
+	if (bLockstep) {
+		//VRand normalises through FMath::InvSqrt, whose last bits differ between CPUs.
+		//A point picked in the unit sphere by rejection only needs exact float maths.
+		FVector Direction;
+		float SizeSquared;
+		do {
+			Direction = FVector(LockstepRandom.GetFraction(), LockstepRandom.GetFraction(), LockstepRandom.GetFraction()) * 2.f - FVector(1.f);
+			SizeSquared = Direction.SizeSquared();
+		} while (SizeSquared > 1.f || SizeSquared < KINDA_SMALL_NUMBER);
+
+		return FlockMath::SafeNormal(Direction) * (LockstepRandom.GetFraction() * SpawnRadius);
+	}
+
+	return FMath::VRand() * FMath::FRandRange(0.f, SpawnRadius);
+}
+
+void AFlockManager::RebuildFlowField()
+{
+	if (!bUseFlowField) {
+		FlowField.Reset();
+		return;
+	}
+
+	const FTransform& Transform = GetActorTransform();
+	const FVector Origin = GetActorLocation();
+
+	TArray<FFlockFlowElement> Elements;
+
+	//Params' vortex, round the manager rather than each boid's spawn point.
+	//Return to spawn stays per boid, every boid can have its own spawn location.
+	FFlockFlowElement Vortex;
+	Vortex.Type = EFlockFlowElementType::Vortex;
+	Vortex.Location = Origin;
+	Vortex.Axis = FVector::UpVector;
+	Vortex.Strength = Params.VortexRate;
+	Vortex.bClockwise = Params.VortexClockwise;
+	Elements.Add(Vortex);
+
+	for (const FFlockFlowElement& Element : FlowElements) {
+		FFlockFlowElement& Placed = Elements.Add_GetRef(Element);
+		Placed.Location = Transform.TransformPosition(Element.Location);
+		Placed.Axis = Transform.TransformVectorNoScale(Element.Axis);
+	}
+
+	TArray<FVector> Nodes;
+	for (const AActor* Node : FlowFieldNodes) {
+		if (Node != nullptr) {
+			Nodes.Add(Node->GetActorLocation());
+		}
+	}
+
+	//One vortex per stretch between consecutive nodes, each wraps round its ends so the line has no gaps
+	if (Nodes.Num() == 1) {
+		FFlockFlowElement& Single = Elements.Add_GetRef(NodeVortex);
+		Single.Type = EFlockFlowElementType::Vortex;
+		Single.Location = Nodes[0];
+		Single.Length = 0.f;
+	}
+	for (int32 Node = 0; Node + 1 < Nodes.Num(); ++Node) {
+		FFlockFlowElement& Segment = Elements.Add_GetRef(NodeVortex);
+		Segment.Type = EFlockFlowElementType::Vortex;
+		Segment.Location = Nodes[Node];
+		Segment.Axis = Nodes[Node + 1] - Nodes[Node];
+		Segment.Length = Segment.Axis.Size();
+	}
+
+	TArray<UFlockTornadoComponent*> Tornadoes;
+	for (const AActor* Actor : FlowFieldTornadoes) {
+		if (Actor != nullptr) {
+			Actor->ForEachComponent<UFlockTornadoComponent>(false, [&Tornadoes](UFlockTornadoComponent* Tornado) {
+				//Up to date even when the tornado hasn't ticked yet this frame
+				Tornado->UpdateFunnel();
+				Tornadoes.Add(Tornado);
+			});
+		}
+	}
+
+	FlowField.Build(FBox::BuildAABB(Origin, FlowFieldExtent), FlowFieldCellSize, [&Elements, &Tornadoes](const FVector& Point) {
+		FVector Flow = FVector::ZeroVector;
+		for (const FFlockFlowElement& Element : Elements) {
+			Flow += Element.Evaluate(Point);
+		}
+		for (const UFlockTornadoComponent* Tornado : Tornadoes) {
+			Flow += Tornado->Evaluate(Point);
+		}
+		return Flow;
+	});
+}
+
+void AFlockManager::UpdateLODViews()
+{
+	Simulation.LODViews.Reset();
+
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It) {
+		APlayerController* Controller = It->Get();
+		if (Controller == nullptr) continue;
+
+		FVector Location;
+		FRotator Rotation;
+		Controller->GetPlayerViewPoint(Location, Rotation);
+
+		//A little wider than the camera so boids don't pop at the screen edges
+		const float FOV = Controller->PlayerCameraManager != nullptr ? Controller->PlayerCameraManager->GetFOVAngle() : 90.f;
+		const float HalfAngle = FMath::Min(0.5f * FOV + 10.f, 89.f);
+
+		FFlockLODView& View = Simulation.LODViews.AddDefaulted_GetRef();
+		View.Location = Location;
+		View.Direction = Rotation.Vector();
+		View.CosHalfFOV = FMath::Cos(FMath::DegreesToRadians(HalfAngle));
+	}
+}
+
+void AFlockManager::UpdateNetSnapshot(float DeltaTime)
+{
+	const int32 Count = Simulation.Num();
+
+	//An emptied flock is sent once so clients drop their boids too
+	if (Count == 0) {
+		if (NetSnapshot.BoidCount != 0) {
+			NetSnapshot.Build(Simulation, 0, 0, GetWorld()->GetTimeSeconds());
+			ForceNetUpdate();
+		}
+		return;
+	}
+
+	//Nearer players get more frequent, smaller snapshots for the same bytes per second
+	float NearestDistance = NetRelevantDistance;
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It) {
+		APlayerController* Controller = It->Get();
+		if (Controller == nullptr || Controller->IsLocalController()) continue;
+
+		FVector Location;
+		FRotator Rotation;
+		Controller->GetPlayerViewPoint(Location, Rotation);
+		NearestDistance = FMath::Min(NearestDistance, FVector::Dist(Location, GetActorLocation()));
+	}
+
+	const float Relevance = 1.f - NearestDistance / FMath::Max(NetRelevantDistance, 1.f);
+	const float SendRate = FMath::Max(FMath::Lerp(MinNetSendRate, MaxNetSendRate, Relevance), 0.1f);
+
+	NetSendTimer += DeltaTime;
+	if (NetSendTimer < 1.f / SendRate) return;
+
+	//The snapshot spends the bytes of all the time since the last one
+	const float Interval = FMath::Min(NetSendTimer, 1.f);
+	NetSendTimer = 0.f;
+
+	const int32 BoidBits = FFlockNetSnapshot::BoidBits + (Simulation.Species.Num() > 1 ? FFlockNetSnapshot::SpeciesBits : 0);
+	const int32 BudgetBits = FMath::FloorToInt(NetBytesPerSecond * 8.f * Interval) - FFlockNetSnapshot::HeaderBits;
+	const int32 SliceCount = FMath::Clamp(BudgetBits / BoidBits, 1, Count);
+
+	NetSnapshot.Build(Simulation, NetNextIndex, SliceCount, GetWorld()->GetTimeSeconds());
+	NetNextIndex = (NetSnapshot.FirstIndex + SliceCount) % Count;
+	ForceNetUpdate();
+
+	INC_DWORD_STAT_BY(STAT_FlockNetBytes, (FFlockNetSnapshot::HeaderBits + NetSnapshot.Num() * NetSnapshot.GetBoidBits()) / 8);
+}
+
+void AFlockManager::OnRep_NetSnapshot()
+{
+	if (!bReplicateFlock || bLockstep || HasAuthority()) return;
+	if (bCompactStorage && bUseInstancedRendering) return;
+
+	ResizeNetFlock(NetSnapshot.BoidCount);
+
+	//Carried forward by the snapshot's age, so boids land where the server has them now
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	const float Age = GameState != nullptr ? FMath::Clamp(GameState->GetServerWorldTimeSeconds() - NetSnapshot.ServerTime, 0.f, 1.f) : 0.f;
+
+	for (int32 Slot = 0; Slot < NetSnapshot.Num(); ++Slot) {
+		const int32 Index = NetSnapshot.GetIndex(Slot);
+		if (!Simulation.Positions.IsValidIndex(Index)) continue;
+
+		const FVector Velocity = NetSnapshot.GetVelocity(Slot);
+		Simulation.CorrectBoid(Index, NetSnapshot.GetPosition(Slot) + Velocity * Age, Velocity);
+
+		if (NetSnapshot.bHasSpecies) {
+			Simulation.BoidSpecies[Index] = NetSnapshot.Boids[Slot].Species;
+		}
+	}
+}
+
+void AFlockManager::ResizeNetFlock(int32 Count)
+{
+	//Views on a client were spawned by the client, nobody else owns them
+	while (Simulation.Num() > Count) {
+		const int32 Last = Simulation.Num() - 1;
+		ABoid* Boid = Views[Last];
+		RemoveBoidAt(Last);
+
+		if (Boid != nullptr) {
+			Boid->DetachFromFlock();
+			Boid->Destroy();
+		}
+	}
+
+	const int32 First = Simulation.Num();
+	if (Count > First) {
+		//Dropped amid the flock until their slice arrives, they return to the manager like the server's boids
+		SpawnBoids(Count - First, NetSnapshot.Centroid);
+		for (int32 Index = First; Index < Simulation.Num(); ++Index) {
+			SetBoidSpawnLocation(Index, GetActorLocation());
+		}
+	}
+}
+
+void AFlockManager::BakeObstacleField()
+{
+#if WITH_EDITOR
+	if (ObstacleField == nullptr) {
+		UE_LOG(LogFlock, Warning, TEXT("%s: assign a FlockObstacleField asset before baking"), *GetName());
+		return;
+	}
+
+	const FBox BakeBounds = FBox::BuildAABB(GetActorLocation(), BakeExtent);
+	if (ObstacleField->Bake(GetWorld(), BakeBounds, BakeVoxelSize)) {
+		UE_LOG(LogFlock, Log, TEXT("%s: baked %s, %d x %d x %d voxels"), *GetName(), *ObstacleField->GetName(), ObstacleField->Resolution.X, ObstacleField->Resolution.Y, ObstacleField->Resolution.Z);
+	}
+#endif
+}
+
+void AFlockManager::BakeWarmupState()
+{
+#if WITH_EDITOR
+	if (WarmupState == nullptr) {
+		UE_LOG(LogFlock, Warning, TEXT("%s: assign a FlockWarmupState asset before baking"), *GetName());
+		return;
+	}
+
+	const UFlockObstacleField* Field = (ObstacleField != nullptr && ObstacleField->IsValid()) ? ObstacleField : nullptr;
+	if (WarmupState->Bake(Params, Species, Field, GetActorLocation(), InitialBoidCount, SpawnRadius, WarmupSeconds, WarmupStepRate)) {
+		UE_LOG(LogFlock, Log, TEXT("%s: baked %s, %d boids after %.1f s"), *GetName(), *WarmupState->GetName(), WarmupState->Num(), WarmupState->SimulatedSeconds);
+	}
+#endif
+}
+
+void AFlockManager::RecordPlaybackClip()
+{
+#if WITH_EDITOR
+	if (PlaybackClip == nullptr) {
+		UE_LOG(LogFlock, Warning, TEXT("%s: assign a FlockPlaybackClip asset before recording"), *GetName());
+		return;
+	}
+
+	const UFlockObstacleField* Field = (ObstacleField != nullptr && ObstacleField->IsValid()) ? ObstacleField : nullptr;
+	if (PlaybackClip->Record(Params, Species, Field, GetActorLocation(), InitialBoidCount, SpawnRadius, WarmupSeconds, RecordDuration, RecordFrameRate, RecordBlendSeconds)) {
+		UE_LOG(LogFlock, Log, TEXT("%s: recorded %s, %d boids, %d frames"), *GetName(), *PlaybackClip->GetName(), PlaybackClip->BoidCount, PlaybackClip->FrameCount);
+	}
+#endif
+}
+
+void AFlockManager::SpawnFromWarmupState()
+{
+	UWorld* World = GetWorld();
+	if (World == nullptr) return;
+
+	const FVector Origin = GetActorLocation();
+	const int32 Count = WarmupState->Num();
+
+	if (bCompactStorage && bUseInstancedRendering) {
+		for (int32 i = 0; i < Count; ++i) {
+			CompactSimulation.AddBoid(Origin + WarmupState->Positions[i], WarmupState->Velocities[i], Origin + WarmupState->SpawnOffsets[i], Params.MaxSpeed);
+		}
+		return;
+	}
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.Owner = this;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	Views.Reserve(Views.Num() + Count);
+
+	for (int32 i = 0; i < Count; ++i) {
+		const FVector Location = Origin + WarmupState->Positions[i];
+		const FVector SpawnLocation = Origin + WarmupState->SpawnOffsets[i];
+
+		ABoid* Boid = nullptr;
+		if (BoidClass != nullptr && !bUseInstancedRendering) {
+			Boid = World->SpawnActor<ABoid>(BoidClass, Location, FRotator::ZeroRotator, SpawnParams);
+		}
+
+		int32 Index = INDEX_NONE;
+		if (Boid != nullptr) {
+			Index = RegisterBoid(Boid, SpawnLocation);
+		}
+		else {
+			Index = Simulation.AddBoid(Location, WarmupState->Velocities[i], SpawnLocation);
+			Views.Add(nullptr);
+		}
+
+		//RegisterBoid starts the boid off with the spawn impulse, the baked state replaces it
+		if (Index != INDEX_NONE) {
+			Simulation.Velocities[Index] = WarmupState->Velocities[i];
+			Simulation.Orientations[Index] = WarmupState->Orientations[i];
+		}
+	}
+}
+
+void AFlockManager::SpawnBoids(int32 Count, FVector SpawnLocation, int32 SpeciesIndex)
+{
+	UWorld* World = GetWorld();
+	if (World == nullptr) return;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.Owner = this;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	Views.Reserve(Views.Num() + Count);
+
+	if (bCompactStorage && bUseInstancedRendering) {
+		for (int32 i = 0; i < Count; ++i) {
+			const FVector Location = SpawnLocation + RandomSpawnOffset();
+			const FVector Velocity = FlockMath::SafeNormal(Location - SpawnLocation) * Params.MaxSpeed * Params.ExpandRate;
+			CompactSimulation.AddBoid(Location, Velocity, SpawnLocation, Params.MaxSpeed);
+		}
+		return;
+	}
+
+	for (int32 i = 0; i < Count; ++i) {
+		const FVector Location = SpawnLocation + RandomSpawnOffset();
+
+		ABoid* Boid = nullptr;
+		if (BoidClass != nullptr && !bUseInstancedRendering) {
+			Boid = World->SpawnActor<ABoid>(BoidClass, Location, FRotator::ZeroRotator, SpawnParams);
+		}
+
+		if (Boid != nullptr) {
+			Boid->Species = SpeciesIndex;
+			RegisterBoid(Boid, SpawnLocation);
+		}
+		else {
+			//No view, the boid only lives in the simulation
+			FVector Velocity = FlockMath::SafeNormal(Location - SpawnLocation) * Params.MaxSpeed * Params.ExpandRate;
+			Simulation.AddBoid(Location, Velocity, SpawnLocation, (uint8)FMath::Clamp(SpeciesIndex, 0, 31));
+			Views.Add(nullptr);
+		}
+	}
+}
+
+int32 AFlockManager::RegisterBoid(ABoid* Boid, FVector SpawnLocation)
+{
+	if (Boid == nullptr) return INDEX_NONE;
+	if (Boid->Manager == this) return Boid->FlockIndex;
+
+	if (bCompactStorage && bUseInstancedRendering) {
+		UE_LOG(LogFlock, Warning, TEXT("%s: compact flocks have no boid actors, %s was not registered"), *GetName(), *Boid->GetName());
+		return INDEX_NONE;
+	}
+
+	//Same push away from the spawn point as ABoid::SetSpawnPointLocation
+	const FVector Location = Boid->GetActorLocation();
+	const FVector Velocity = FlockMath::SafeNormal(Location - SpawnLocation) * Params.MaxSpeed * Params.ExpandRate;
+
+	const int32 Index = Simulation.AddBoid(Location, Velocity, SpawnLocation, (uint8)FMath::Clamp(Boid->Species, 0, 31));
+	Views.Add(Boid);
+	check(Views.Num() == Simulation.Num());
+
+	Boid->AttachToFlock(this, Index);
+
+	return Index;
+}
+
+void AFlockManager::UnregisterBoid(ABoid* Boid)
+{
+	if (Boid == nullptr || Boid->Manager != this) return;
+
+	const int32 Index = Boid->FlockIndex;
+	if (!Views.IsValidIndex(Index) || Views[Index] != Boid) return;
+
+	RemoveBoidAt(Index);
+
+	//The last boid was moved into the freed slot
+	if (Views.IsValidIndex(Index) && Views[Index] != nullptr) {
+		Views[Index]->FlockIndex = Index;
+	}
+
+	Boid->DetachFromFlock();
+}
+
+void AFlockManager::RemoveBoidAt(int32 Index)
+{
+	Simulation.RemoveBoid(Index);
+	ObstacleTracer.RemoveBoid(Index);
+	Views.RemoveAtSwap(Index, 1, false);
+}
+
+void AFlockManager::SetBoidSpawnLocation(int32 Index, FVector NewSpawnLocation)
+{
+	if (Simulation.SpawnLocations.IsValidIndex(Index)) {
+		Simulation.SpawnLocations[Index] = NewSpawnLocation;
+	}
+}
+
+void AFlockManager::PushViews()
+{
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockPushViews);
+
+	const TArray<FVector>& Velocities = Simulation.Velocities;
+	const TArray<FQuat>& Orientations = Simulation.Orientations;
+	const float Threshold = FMath::DegreesToRadians(OrientThreshold);
+
+	//Render positions, so time sliced boids don't visibly jump when they are re-evaluated
+	for (int32 Index = 0; Index < Views.Num(); ++Index) {
+		if (Views[Index] != nullptr) {
+			Views[Index]->UpdateFromFlock(Simulation.GetRenderPosition(Index), Velocities[Index], Orientations[Index], Threshold);
+		}
+	}
+}
+
+void AFlockManager::PushInstances()
+{
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockPushInstances);
+
+	const TArray<FQuat>& Orientations = Simulation.Orientations;
+	const int32 Count = Simulation.Num();
+
+	//Positions change every frame anyway, so every instance is rewritten with its stepped orientation
+	InstanceTransforms.SetNum(Count, false);
+	for (int32 Index = 0; Index < Count; ++Index) {
+		InstanceTransforms[Index] = FTransform(Orientations[Index], Simulation.GetRenderPosition(Index));
+	}
+
+	ResizeInstances(Count);
+
+	if (Count > 0) {
+		InstancedMesh->BatchUpdateInstancesTransforms(0, InstanceTransforms, true, true, true);
+	}
+}
+
+void AFlockManager::PushCompactInstances()
+{
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockPushInstances);
+
+	const int32 Count = CompactSimulation.Num();
+
+	InstanceTransforms.SetNum(Count, false);
+	for (int32 Index = 0; Index < Count; ++Index) {
+		const FQuat Orientation = FRotationMatrix::MakeFromX(CompactSimulation.GetDirection(Index)).ToQuat();
+		InstanceTransforms[Index] = FTransform(Orientation, CompactSimulation.GetPosition(Index));
+	}
+
+	ResizeInstances(Count);
+
+	if (Count > 0) {
+		InstancedMesh->BatchUpdateInstancesTransforms(0, InstanceTransforms, true, true, true);
+	}
+}
+
+void AFlockManager::PushPlaybackInstances()
+{
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockPushInstances);
+
+	const int32 Count = PlaybackClip->BoidCount;
+	const FVector Origin = GetActorLocation();
+
+	InstanceTransforms.SetNum(Count, false);
+	for (int32 Index = 0; Index < Count; ++Index) {
+		FVector Location;
+		FQuat Orientation;
+		PlaybackClip->Sample(Index, PlaybackTime, Location, Orientation);
+		InstanceTransforms[Index] = FTransform(Orientation, Origin + Location);
+	}
+
+	ResizeInstances(Count);
+
+	if (Count > 0) {
+		InstancedMesh->BatchUpdateInstancesTransforms(0, InstanceTransforms, true, true, true);
+	}
+}
+
+void AFlockManager::ResizeInstances(int32 Count)
+{
+	check(InstanceTransforms.Num() == Count);
+
+	//Boids were added or swap-removed since last frame, only the count matters as every transform is rewritten
+	//in world space right after. One batch either way, single instance calls dirty the render state each time.
+	const int32 Current = InstancedMesh->GetInstanceCount();
+	if (Current > Count) {
+		InstancedMesh->ClearInstances();
+		InstancedMesh->AddInstances(InstanceTransforms, false);
+	}
+	else if (Current < Count) {
+		const TArray<FTransform> Added(InstanceTransforms.GetData() + Current, Count - Current);
+		InstancedMesh->AddInstances(Added, false);
+	}
+}
@@ -0,0 +1,191 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockObstacleField.h"
+#include "Engine/World.h"
+#include "CollisionQueryParams.h"
+#include "WorldCollision.h"
+
+float UFlockObstacleField::Sample(const FVector& Location, FVector& OutGradient) const
+{
+	OutGradient = FVector::ZeroVector;
+	if (!IsValid() || !Bounds.IsInside(Location)) return BIG_NUMBER;
+
+	//Samples sit at voxel centres
+	const FVector Local = (Location - Bounds.Min) / VoxelSize - FVector(0.5f);
+
+	const int32 X0 = FMath::Clamp(FMath::FloorToInt(Local.X), 0, FMath::Max(Resolution.X - 2, 0));
+	const int32 Y0 = FMath::Clamp(FMath::FloorToInt(Local.Y), 0, FMath::Max(Resolution.Y - 2, 0));
+	const int32 Z0 = FMath::Clamp(FMath::FloorToInt(Local.Z), 0, FMath::Max(Resolution.Z - 2, 0));
+	const int32 X1 = FMath::Min(X0 + 1, Resolution.X - 1);
+	const int32 Y1 = FMath::Min(Y0 + 1, Resolution.Y - 1);
+	const int32 Z1 = FMath::Min(Z0 + 1, Resolution.Z - 1);
+
+	const float TX = FMath::Clamp(Local.X - X0, 0.f, 1.f);
+	const float TY = FMath::Clamp(Local.Y - Y0, 0.f, 1.f);
+	const float TZ = FMath::Clamp(Local.Z - Z0, 0.f, 1.f);
+
+	const float D000 = Distances[GetVoxelIndex(X0, Y0, Z0)];
+	const float D100 = Distances[GetVoxelIndex(X1, Y0, Z0)];
+	const float D010 = Distances[GetVoxelIndex(X0, Y1, Z0)];
+	const float D110 = Distances[GetVoxelIndex(X1, Y1, Z0)];
+	const float D001 = Distances[GetVoxelIndex(X0, Y0, Z1)];
+	const float D101 = Distances[GetVoxelIndex(X1, Y0, Z1)];
+	const float D011 = Distances[GetVoxelIndex(X0, Y1, Z1)];
+	const float D111 = Distances[GetVoxelIndex(X1, Y1, Z1)];
+
+	//Interpolate along X, then Y, then Z, keeping the partial derivatives of each stage
+	const float D00 = FMath::Lerp(D000, D100, TX);
+	const float D10 = FMath::Lerp(D010, D110, TX);
+	const float D01 = FMath::Lerp(D001, D101, TX);
+	const float D11 = FMath::Lerp(D011, D111, TX);
+
+	const float D0 = FMath::Lerp(D00, D10, TY);
+	const float D1 = FMath::Lerp(D01, D11, TY);
+
+	const float DX0 = FMath::Lerp(D100 - D000, D110 - D010, TY);
+	const float DX1 = FMath::Lerp(D101 - D001, D111 - D011, TY);
+
+	OutGradient.X = FMath::Lerp(DX0, DX1, TZ);
+	OutGradient.Y = FMath::Lerp(D10 - D00, D11 - D01, TZ);
+	OutGradient.Z = D1 - D0;
+	OutGradient /= VoxelSize;
+
+	return FMath::Lerp(D0, D1, TZ);
+}
+
+float UFlockObstacleField::SampleDistance(FVector Location) const
+{
+	FVector Gradient;
+	return Sample(Location, Gradient);
+}
+
+#if WITH_EDITOR
+
+//Stands for "no seed", far enough for any bake yet safe to add squared voxel offsets to
+static const float FarDistanceSquared = 1.e20f;
+
+//Felzenszwalb & Huttenlocher squared distance transform of one line, in voxel units
+static void DistanceTransformLine(const float* In, float* Out, int32 Count, int32* Parabolas, float* Bounds)
+{
+	int32 K = 0;
+	Parabolas[0] = 0;
+	Bounds[0] = -BIG_NUMBER;
+	Bounds[1] = BIG_NUMBER;
+
+	for (int32 Q = 1; Q < Count; ++Q) {
+		//Drop the parabolas the new one hides, the first bound is -BIG_NUMBER so this stops at K == 0
+		float S = ((In[Q] + Q * Q) - (In[Parabolas[K]] + Parabolas[K] * Parabolas[K])) / (2.f * (Q - Parabolas[K]));
+		while (S <= Bounds[K]) {
+			--K;
+			S = ((In[Q] + Q * Q) - (In[Parabolas[K]] + Parabolas[K] * Parabolas[K])) / (2.f * (Q - Parabolas[K]));
+		}
+		++K;
+		Parabolas[K] = Q;
+		Bounds[K] = S;
+		Bounds[K + 1] = BIG_NUMBER;
+	}
+
+	K = 0;
+	for (int32 Q = 0; Q < Count; ++Q) {
+		while (Bounds[K + 1] < Q) ++K;
+		const int32 V = Parabolas[K];
+		Out[Q] = (Q - V) * (Q - V) + In[V];
+	}
+}
+
+//Squared distance from every voxel to the closest seed voxel (Field == 0), every other voxel starts at FarDistanceSquared
+static void DistanceTransform3D(TArray<float>& Field, const FIntVector& Resolution)
+{
+	const int32 MaxCount = FMath::Max3(Resolution.X, Resolution.Y, Resolution.Z);
+	TArray<float> LineIn, LineOut, Bounds;
+	TArray<int32> Parabolas;
+	LineIn.SetNumUninitialized(MaxCount);
+	LineOut.SetNumUninitialized(MaxCount);
+	Bounds.SetNumUninitialized(MaxCount + 1);
+	Parabolas.SetNumUninitialized(MaxCount);
+
+	const int32 Strides[3] = { 1, Resolution.X, Resolution.X * Resolution.Y };
+	const int32 Counts[3] = { Resolution.X, Resolution.Y, Resolution.Z };
+
+	//Separable, one pass per axis over every line along it
+	for (int32 Axis = 0; Axis < 3; ++Axis) {
+		const int32 Count = Counts[Axis];
+		const int32 Stride = Strides[Axis];
+		const int32 OtherA = Counts[(Axis + 1) % 3];
+		const int32 OtherB = Counts[(Axis + 2) % 3];
+		const int32 StrideA = Strides[(Axis + 1) % 3];
+		const int32 StrideB = Strides[(Axis + 2) % 3];
+
+		for (int32 B = 0; B < OtherB; ++B) {
+			for (int32 A = 0; A < OtherA; ++A) {
+				const int32 Start = A * StrideA + B * StrideB;
+				for (int32 Q = 0; Q < Count; ++Q) {
+					LineIn[Q] = Field[Start + Q * Stride];
+				}
+				DistanceTransformLine(LineIn.GetData(), LineOut.GetData(), Count, Parabolas.GetData(), Bounds.GetData());
+				for (int32 Q = 0; Q < Count; ++Q) {
+					Field[Start + Q * Stride] = LineOut[Q];
+				}
+			}
+		}
+	}
+}
+
+bool UFlockObstacleField::Bake(UWorld* World, const FBox& InBounds, float InVoxelSize)
+{
+	if (World == nullptr || !InBounds.IsValid || InVoxelSize <= 0.f) return false;
+
+	//Keep the bake to a sane size, 256^3 voxels at most
+	const FVector Size = InBounds.GetSize();
+	const float MinVoxelSize = Size.GetMax() / 256.f;
+	VoxelSize = FMath::Max(InVoxelSize, MinVoxelSize);
+
+	Resolution = FIntVector(
+		FMath::Max(FMath::CeilToInt(Size.X / VoxelSize), 2),
+		FMath::Max(FMath::CeilToInt(Size.Y / VoxelSize), 2),
+		FMath::Max(FMath::CeilToInt(Size.Z / VoxelSize), 2));
+	Bounds = FBox(InBounds.Min, InBounds.Min + FVector(Resolution) * VoxelSize);
+
+	const int32 VoxelCount = Resolution.X * Resolution.Y * Resolution.Z;
+
+	//Occupancy, only static geometry counts
+	TArray<bool> Occupied;
+	Occupied.SetNumZeroed(VoxelCount);
+
+	const FCollisionShape VoxelShape = FCollisionShape::MakeBox(FVector(VoxelSize * 0.5f));
+	const FCollisionObjectQueryParams ObjectParams(ECC_WorldStatic);
+	const FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(FlockObstacleFieldBake), true);
+
+	for (int32 Z = 0; Z < Resolution.Z; ++Z) {
+		for (int32 Y = 0; Y < Resolution.Y; ++Y) {
+			for (int32 X = 0; X < Resolution.X; ++X) {
+				const FVector Centre = Bounds.Min + (FVector(X, Y, Z) + FVector(0.5f)) * VoxelSize;
+				Occupied[GetVoxelIndex(X, Y, Z)] = World->OverlapAnyTestByObjectType(Centre, FQuat::Identity, ObjectParams, VoxelShape, QueryParams);
+			}
+		}
+	}
+
+	//Distance to the nearest occupied voxel outside, and to the nearest free voxel inside
+	TArray<float> Outside, Inside;
+	Outside.SetNumUninitialized(VoxelCount);
+	Inside.SetNumUninitialized(VoxelCount);
+	for (int32 Voxel = 0; Voxel < VoxelCount; ++Voxel) {
+		Outside[Voxel] = Occupied[Voxel] ? 0.f : FarDistanceSquared;
+		Inside[Voxel] = Occupied[Voxel] ? FarDistanceSquared : 0.f;
+	}
+	DistanceTransform3D(Outside, Resolution);
+	DistanceTransform3D(Inside, Resolution);
+
+	//Half a voxel moves the zero crossing from the voxel centres onto the surface
+	Distances.SetNumUninitialized(VoxelCount);
+	for (int32 Voxel = 0; Voxel < VoxelCount; ++Voxel) {
+		const float Signed = Occupied[Voxel] ? -(FMath::Sqrt(Inside[Voxel]) - 0.5f) : (FMath::Sqrt(Outside[Voxel]) - 0.5f);
+		Distances[Voxel] = Signed * VoxelSize;
+	}
+
+	MarkPackageDirty();
+	return true;
+}
+
+#endif
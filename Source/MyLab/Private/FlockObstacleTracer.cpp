@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockObstacleTracer.h"
+#include "FlockSimulation.h"
+#include "Engine/World.h"
+
+FFlockObstacleTracer::FFlockObstacleTracer()
+{
+	ObjectType = ECC_WorldStatic;
+	MaxTracesPerFrame = 64;
+	MinRetraceInterval = 0.05f;
+	MaxRetraceInterval = 1.f;
+	WhiskerAngle = 30.f;
+
+	Cursor = 0;
+	TracesLastFrame = 0;
+}
+
+void FFlockObstacleTracer::Update(UWorld* World, FFlockSimulation& Simulation, const FCollisionQueryParams& QueryParams)
+{
+	if (World == nullptr) return;
+
+	const float Now = World->GetTimeSeconds();
+	const int32 Count = Simulation.Num();
+
+	//Boids added since last frame are due straight away
+	while (NextTraceTime.Num() < Count) {
+		NextTraceTime.Add(Now);
+		LastHitTime.Add(Now - MaxRetraceInterval);
+		bLeftWhisker.Add(false);
+	}
+
+	ConsumeResults(World, Simulation, Now);
+	IssueTraces(World, Simulation, QueryParams, Now);
+}
+
+void FFlockObstacleTracer::ConsumeResults(UWorld* World, FFlockSimulation& Simulation, float Now)
+{
+	for (const FPendingTrace& Pending : PendingTraces) {
+		if (!Simulation.Avoidance.IsValidIndex(Pending.BoidIndex)) continue;
+
+		FVector& Avoidance = Simulation.Avoidance[Pending.BoidIndex];
+
+		//Both whiskers of a boid are issued together, start from a clean slate on the first one
+		if (Pending.bFirstWhisker) {
+			Avoidance = FVector::ZeroVector;
+		}
+
+		FTraceDatum Datum;
+		if (!World->QueryTraceData(Pending.Handle, Datum)) continue;
+
+		const FHitResult* Hit = FHitResult::GetFirstBlockingHit(Datum.OutHits);
+		if (Hit != nullptr) {
+			//Push along the surface normal, harder the closer the hit
+			Avoidance += Hit->ImpactNormal * (1.f - Hit->Time);
+			LastHitTime[Pending.BoidIndex] = Now;
+		}
+	}
+
+	PendingTraces.Reset();
+}
+
+void FFlockObstacleTracer::IssueTraces(UWorld* World, const FFlockSimulation& Simulation, const FCollisionQueryParams& QueryParams, float Now)
+{
+	const int32 Count = Simulation.Num();
+	const float TraceLength = Simulation.Params.TraceLength;
+	//Start outside the boid's own sphere
+	const float StartOffset = Simulation.Params.ContactRadius;
+
+	TracesLastFrame = 0;
+	if (Count == 0 || TraceLength <= 0.f) return;
+
+	//By object type rather than channel, boid spheres block every channel
+	const FCollisionObjectQueryParams ObjectParams(ObjectType);
+
+	Cursor = Cursor % Count;
+
+	for (int32 Scanned = 0; Scanned < Count && TracesLastFrame + 2 <= MaxTracesPerFrame; ++Scanned) {
+		const int32 Index = Cursor;
+		Cursor = (Cursor + 1) % Count;
+
+		if (NextTraceTime[Index] > Now) continue;
+
+		const FVector Velocity = Simulation.Velocities[Index];
+		const float Speed = Velocity.Size();
+		if (Speed < KINDA_SMALL_NUMBER) {
+			NextTraceTime[Index] = Now + MaxRetraceInterval;
+			continue;
+		}
+
+		const FVector Forward = Velocity / Speed;
+		const FVector Side = Forward.RotateAngleAxis(bLeftWhisker[Index] ? -WhiskerAngle : WhiskerAngle, FVector::UpVector);
+		bLeftWhisker[Index] = !bLeftWhisker[Index];
+
+		const FVector Location = Simulation.Positions[Index];
+
+		FPendingTrace& Center = PendingTraces.AddDefaulted_GetRef();
+		Center.Handle = World->AsyncLineTraceByObjectType(EAsyncTraceType::Single, Location + Forward * StartOffset, Location + Forward * TraceLength, ObjectParams, QueryParams);
+		Center.BoidIndex = Index;
+		Center.bFirstWhisker = true;
+
+		FPendingTrace& Whisker = PendingTraces.AddDefaulted_GetRef();
+		Whisker.Handle = World->AsyncLineTraceByObjectType(EAsyncTraceType::Single, Location + Side * StartOffset, Location + Side * TraceLength, ObjectParams, QueryParams);
+		Whisker.BoidIndex = Index;
+		Whisker.bFirstWhisker = false;
+
+		TracesLastFrame += 2;
+
+		//Fast boids cover the trace length sooner, and anything near an obstacle keeps looking
+		float Interval = FMath::Clamp(0.5f * TraceLength / Speed, MinRetraceInterval, MaxRetraceInterval);
+		if (Now - LastHitTime[Index] < MaxRetraceInterval) {
+			Interval = MinRetraceInterval;
+		}
+		NextTraceTime[Index] = Now + Interval;
+	}
+}
+
+void FFlockObstacleTracer::RemoveBoid(int32 Index)
+{
+	if (NextTraceTime.IsValidIndex(Index)) {
+		NextTraceTime.RemoveAtSwap(Index, 1, false);
+		LastHitTime.RemoveAtSwap(Index, 1, false);
+		bLeftWhisker.RemoveAtSwap(Index, 1, false);
+	}
+
+	//In flight results would land on the wrong boid, drop them
+	PendingTraces.Reset();
+}
+
+void FFlockObstacleTracer::Reset()
+{
+	PendingTraces.Reset();
+	NextTraceTime.Reset();
+	LastHitTime.Reset();
+	bLeftWhisker.Reset();
+	Cursor = 0;
+	TracesLastFrame = 0;
+}
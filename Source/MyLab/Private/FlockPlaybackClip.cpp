@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockPlaybackClip.h"
+#include "FlockSimulation.h"
+#include "Math/RandomStream.h"
+
+void UFlockPlaybackClip::Sample(int32 Boid, float Time, FVector& OutLocation, FQuat& OutOrientation) const
+{
+	const float Frame = FMath::Fmod(Time * FrameRate, (float)FrameCount);
+	const float Wrapped = Frame < 0.f ? Frame + FrameCount : Frame;
+
+	const int32 Frame0 = FMath::Min(FMath::FloorToInt(Wrapped), FrameCount - 1);
+	const int32 Frame1 = (Frame0 + 1) % FrameCount;
+
+	const FVector Location0 = GetFramePosition(Frame0, Boid);
+	const FVector Location1 = GetFramePosition(Frame1, Boid);
+
+	const float Alpha = Wrapped - Frame0;
+	OutLocation = FMath::Lerp(Location0, Location1, Alpha);
+
+	//Facing straight from one keyframe to the next would snap round at every keyframe
+	OutOrientation = FQuat::Slerp(GetFrameOrientation(Frame0, Boid), GetFrameOrientation(Frame1, Boid), Alpha).GetNormalized();
+}
+
+FQuat UFlockPlaybackClip::GetFrameOrientation(int32 Frame, int32 Boid) const
+{
+	const FVector Previous = GetFramePosition((Frame + FrameCount - 1) % FrameCount, Boid);
+	const FVector Next = GetFramePosition((Frame + 1) % FrameCount, Boid);
+
+	const FVector Direction = (Next - Previous).GetSafeNormal();
+	return Direction.IsZero() ? FQuat::Identity : FRotationMatrix::MakeFromX(Direction).ToQuat();
+}
+
+#if WITH_EDITOR
+
+bool UFlockPlaybackClip::Record(const FFlockParams& Params, const TArray<FFlockSpecies>& Species, const UFlockObstacleField* ObstacleField, const FVector& Origin, int32 Count, float SpawnRadius,
+	float SettleSeconds, float Duration, float InFrameRate, float BlendSeconds)
+{
+	if (Count <= 0 || InFrameRate <= 0.f || Duration <= 0.f) return false;
+
+	FFlockSimulation Simulation;
+	Simulation.Params = Params;
+	Simulation.Species = Species;
+	Simulation.ObstacleField = ObstacleField;
+	Simulation.Params.bEnableLOD = false;
+	Simulation.Params.bTimeSlice = false;
+
+	//Fixed seed, recording twice with the same settings gives the same clip
+	FRandomStream Random(Count);
+	for (int32 Index = 0; Index < Count; ++Index) {
+		const FVector Location = Origin + Random.GetUnitVector() * Random.FRandRange(0.f, SpawnRadius);
+		const FVector Velocity = (Location - Origin).GetSafeNormal() * Params.MaxSpeed * Params.ExpandRate;
+		Simulation.AddBoid(Location, Velocity, Origin);
+	}
+
+	//Several simulation steps per keyframe, the rules were tuned for small steps
+	const int32 Substeps = FMath::Max(FMath::CeilToInt(30.f / InFrameRate), 1);
+	const float DeltaTime = 1.f / (InFrameRate * Substeps);
+
+	const int32 SettleSteps = FMath::CeilToInt(FMath::Max(SettleSeconds, 0.f) / DeltaTime);
+	for (int32 Step = 0; Step < SettleSteps; ++Step) {
+		Simulation.Step(DeltaTime);
+	}
+
+	const int32 LoopFrames = FMath::Max(FMath::RoundToInt(Duration * InFrameRate), 2);
+	const int32 BlendFrames = FMath::Clamp(FMath::RoundToInt(BlendSeconds * InFrameRate), 0, LoopFrames - 1);
+
+	TArray<FVector> Recorded;
+	Recorded.Reserve((LoopFrames + BlendFrames) * Count);
+	for (int32 Frame = 0; Frame < LoopFrames + BlendFrames; ++Frame) {
+		for (int32 Index = 0; Index < Count; ++Index) {
+			Recorded.Add(Simulation.Positions[Index] - Origin);
+		}
+		for (int32 Step = 0; Step < Substeps; ++Step) {
+			Simulation.Step(DeltaTime);
+		}
+	}
+
+	//The first frames fade from the frames recorded after the loop to their own, so the last frame leads into the first
+	for (int32 Frame = 0; Frame < BlendFrames; ++Frame) {
+		const float Alpha = float(Frame) / BlendFrames;
+		for (int32 Index = 0; Index < Count; ++Index) {
+			FVector& Position = Recorded[Frame * Count + Index];
+			Position = FMath::Lerp(Recorded[(LoopFrames + Frame) * Count + Index], Position, Alpha);
+		}
+	}
+	Recorded.SetNum(LoopFrames * Count);
+
+	BoidCount = Count;
+	FrameCount = LoopFrames;
+	FrameRate = InFrameRate;
+	Bounds = FBox(Recorded).ExpandBy(1.f);
+
+	const FVector Scale = FVector(MAX_uint16) / Bounds.GetSize();
+	Frames.SetNumUninitialized(Recorded.Num() * 3);
+	for (int32 Slot = 0; Slot < Recorded.Num(); ++Slot) {
+		const FVector Local = (Recorded[Slot] - Bounds.Min) * Scale;
+		Frames[Slot * 3] = (uint16)FMath::Clamp(FMath::RoundToInt(Local.X), 0, (int32)MAX_uint16);
+		Frames[Slot * 3 + 1] = (uint16)FMath::Clamp(FMath::RoundToInt(Local.Y), 0, (int32)MAX_uint16);
+		Frames[Slot * 3 + 2] = (uint16)FMath::Clamp(FMath::RoundToInt(Local.Z), 0, (int32)MAX_uint16);
+	}
+
+	MarkPackageDirty();
+	return true;
+}
+
+#endif
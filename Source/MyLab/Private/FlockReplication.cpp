@@ -0,0 +1,147 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockReplication.h"
+#include "FlockSimulation.h"
+
+namespace FlockNet
+{
+	//Anything bigger is a corrupt packet, not a flock
+	static constexpr uint32 MaxBoids = 1u << 20;
+}
+
+FFlockNetSnapshot::FFlockNetSnapshot()
+{
+	Sequence = 0;
+	ServerTime = 0.f;
+	Centroid = FVector::ZeroVector;
+	Extent = 1.f;
+	MaxSpeed = 1.f;
+	BoidCount = 0;
+	FirstIndex = 0;
+	bHasSpecies = false;
+}
+
+void FFlockNetSnapshot::Build(const FFlockSimulation& Simulation, int32 StartIndex, int32 Count, float Time)
+{
+	const TArray<FVector>& Positions = Simulation.Positions;
+	const TArray<FVector>& Velocities = Simulation.Velocities;
+
+	++Sequence;
+	ServerTime = Time;
+	BoidCount = Simulation.Num();
+	FirstIndex = BoidCount > 0 ? StartIndex % BoidCount : 0;
+	MaxSpeed = FMath::Max(Simulation.Params.MaxSpeed, 1.f);
+	bHasSpecies = Simulation.Species.Num() > 1;
+	Count = FMath::Clamp(Count, 0, BoidCount);
+
+	FVector Sum = FVector::ZeroVector;
+	for (const FVector& Position : Positions) {
+		Sum += Position;
+	}
+
+	//Rounded the way FVector_NetQuantize sends it, so both sides decode against the same centroid
+	const FVector Mid = BoidCount > 0 ? Sum / BoidCount : FVector::ZeroVector;
+	Centroid = FVector(FMath::RoundToFloat(Mid.X), FMath::RoundToFloat(Mid.Y), FMath::RoundToFloat(Mid.Z));
+
+	Extent = 1.f;
+	for (int32 Slot = 0; Slot < Count; ++Slot) {
+		Extent = FMath::Max(Extent, (Positions[GetIndex(Slot)] - Centroid).GetAbsMax());
+	}
+
+	const float PositionScale = 0.5f * PositionMax / Extent;
+	const float VelocityScale = VelocityMax / MaxSpeed;
+
+	Boids.SetNumUninitialized(Count);
+	for (int32 Slot = 0; Slot < Count; ++Slot) {
+		const int32 Index = GetIndex(Slot);
+		const FVector Offset = (Positions[Index] - Centroid) * PositionScale + FVector(0.5f * PositionMax);
+		const FVector Velocity = Velocities[Index].GetClampedToMaxSize(MaxSpeed) * VelocityScale + FVector(VelocityMax);
+
+		FFlockNetBoid& Boid = Boids[Slot];
+		Boid.X = (uint16)FMath::Clamp<int32>(FMath::RoundToInt(Offset.X), 0, PositionMax);
+		Boid.Y = (uint16)FMath::Clamp<int32>(FMath::RoundToInt(Offset.Y), 0, PositionMax);
+		Boid.Z = (uint16)FMath::Clamp<int32>(FMath::RoundToInt(Offset.Z), 0, PositionMax);
+		Boid.VelocityX = (uint8)FMath::Clamp<int32>(FMath::RoundToInt(Velocity.X), 0, 2 * VelocityMax);
+		Boid.VelocityY = (uint8)FMath::Clamp<int32>(FMath::RoundToInt(Velocity.Y), 0, 2 * VelocityMax);
+		Boid.VelocityZ = (uint8)FMath::Clamp<int32>(FMath::RoundToInt(Velocity.Z), 0, 2 * VelocityMax);
+		Boid.Species = Simulation.BoidSpecies[Index];
+	}
+}
+
+FVector FFlockNetSnapshot::GetPosition(int32 Slot) const
+{
+	const FFlockNetBoid& Boid = Boids[Slot];
+	const float Scale = 2.f * Extent / PositionMax;
+	return Centroid + FVector(Boid.X, Boid.Y, Boid.Z) * Scale - FVector(Extent);
+}
+
+FVector FFlockNetSnapshot::GetVelocity(int32 Slot) const
+{
+	const FFlockNetBoid& Boid = Boids[Slot];
+	const float Bias = VelocityMax;
+	return FVector(Boid.VelocityX - Bias, Boid.VelocityY - Bias, Boid.VelocityZ - Bias) * (MaxSpeed / VelocityMax);
+}
+
+bool FFlockNetSnapshot::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	bOutSuccess = true;
+
+	Ar << Sequence;
+	Ar << ServerTime;
+	Centroid.NetSerialize(Ar, Map, bOutSuccess);
+	Ar << Extent;
+	Ar << MaxSpeed;
+
+	uint32 PackedCount = BoidCount;
+	uint32 PackedFirst = FirstIndex;
+	uint32 SliceCount = Boids.Num();
+	Ar.SerializeIntPacked(PackedCount);
+	Ar.SerializeIntPacked(PackedFirst);
+	Ar.SerializeIntPacked(SliceCount);
+
+	uint8 SpeciesBit = bHasSpecies ? 1 : 0;
+	Ar.SerializeBits(&SpeciesBit, 1);
+
+	if (Ar.IsLoading()) {
+		if (PackedCount > FlockNet::MaxBoids || SliceCount > PackedCount || (PackedCount > 0 && PackedFirst >= PackedCount) || Extent <= 0.f) {
+			Ar.SetError();
+			bOutSuccess = false;
+			return true;
+		}
+
+		BoidCount = (int32)PackedCount;
+		FirstIndex = (int32)PackedFirst;
+		bHasSpecies = SpeciesBit != 0;
+		Boids.SetNumUninitialized(SliceCount);
+	}
+
+	for (FFlockNetBoid& Boid : Boids) {
+		uint32 X = Boid.X, Y = Boid.Y, Z = Boid.Z;
+		uint32 VelocityX = Boid.VelocityX, VelocityY = Boid.VelocityY, VelocityZ = Boid.VelocityZ;
+		uint32 Species = bHasSpecies ? Boid.Species : 0;
+
+		Ar.SerializeInt(X, PositionMax + 1);
+		Ar.SerializeInt(Y, PositionMax + 1);
+		Ar.SerializeInt(Z, PositionMax + 1);
+		Ar.SerializeInt(VelocityX, 1u << VelocityBits);
+		Ar.SerializeInt(VelocityY, 1u << VelocityBits);
+		Ar.SerializeInt(VelocityZ, 1u << VelocityBits);
+		if (bHasSpecies) {
+			Ar.SerializeInt(Species, 1u << SpeciesBits);
+		}
+
+		if (Ar.IsLoading()) {
+			Boid.X = (uint16)X;
+			Boid.Y = (uint16)Y;
+			Boid.Z = (uint16)Z;
+			Boid.VelocityX = (uint8)VelocityX;
+			Boid.VelocityY = (uint8)VelocityY;
+			Boid.VelocityZ = (uint8)VelocityZ;
+			Boid.Species = (uint8)Species;
+		}
+	}
+
+	bOutSuccess &= !Ar.IsError();
+	return true;
+}
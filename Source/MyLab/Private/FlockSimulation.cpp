@@ -0,0 +1,947 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockSimulation.h"
+#include "FlockObstacleField.h"
+#include "FlockFlowField.h"
+#include "FlockStats.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+
+DEFINE_LOG_CATEGORY(LogFlock);
+
+DEFINE_STAT(STAT_FlockTick);
+DEFINE_STAT(STAT_FlockStep);
+DEFINE_STAT(STAT_FlockGridBuild);
+DEFINE_STAT(STAT_FlockNeighbours);
+DEFINE_STAT(STAT_FlockRules);
+DEFINE_STAT(STAT_FlockIntegrate);
+DEFINE_STAT(STAT_FlockOrient);
+DEFINE_STAT(STAT_FlockCohesion);
+DEFINE_STAT(STAT_FlockSeparation);
+DEFINE_STAT(STAT_FlockAlignment);
+DEFINE_STAT(STAT_FlockKernel);
+DEFINE_STAT(STAT_FlockContactPush);
+DEFINE_STAT(STAT_FlockObstacleTraces);
+DEFINE_STAT(STAT_FlockPushViews);
+DEFINE_STAT(STAT_FlockPushInstances);
+DEFINE_STAT(STAT_BoidTick);
+DEFINE_STAT(STAT_FlockTornado);
+DEFINE_STAT(STAT_FlockBoids);
+DEFINE_STAT(STAT_FlockAverageNeighbours);
+DEFINE_STAT(STAT_FlockNetBytes);
+DEFINE_STAT(STAT_FlockVerletRebuilds);
+DEFINE_STAT(STAT_FlockVerletLifetime);
+DEFINE_STAT(STAT_FlockTornadoBodies);
+
+static TAutoConsoleVariable<int32> CVarFlockSimdKernel(
+	TEXT("flock.SimdKernel"),
+	1,
+	TEXT("1 runs the fused SIMD rules kernel, 0 the scalar Cohesion/Separation/Alignment reference."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarFlockParallelStep(
+	TEXT("flock.ParallelStep"),
+	1,
+	TEXT("1 steps flocks on worker threads, 0 forces a single thread. Results are identical either way."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarFlockValidateKernel(
+	TEXT("flock.ValidateKernel"),
+	0,
+	TEXT("When set, the SIMD kernel result is compared against the scalar reference and mismatches are logged."),
+	ECVF_Default);
+
+FFlockParams::FFlockParams()
+{
+	//Same defaults as ABoid
+	SpeedScale = 10000.f;
+	CohesionRate = 0.25f;
+	SeparationLength = 200.f;
+	SeparationRate = 0.4f;
+	AlignmentRate = 0.2f;
+	ExpandRate = 0.1f;
+	ReturnRate = 0.001f;
+	VortexRate = 0.f;
+	VortexClockwise = true;
+	DistanceFromSpawn = 1000.f;
+	ReOrientRate = 0.1f;
+	AvoidanceRate = 0.f;
+	TraceLength = 400.f;
+	FieldAvoidanceDistance = 200.f;
+
+	SensingRadius = 250.f;
+	bTopological = false;
+	TopologicalNeighbours = 7;
+	TopologicalRadius = 1000.f;
+	TopologicalMaxRings = 4;
+	bVerletLists = false;
+	VerletSkin = 50.f;
+
+	MaxSpeed = 1500.f;
+	LinearDamping = 0.01f;
+
+	bKinematic = false;
+	ContactRadius = 32.f;
+	ContactStiffness = 200.f;
+
+	bEnableLOD = false;
+	LODNearDistance = 3000.f;
+	LODFarDistance = 10000.f;
+	LODOffscreenScale = 3.f;
+	LODMidRuleInterval = 3;
+	LODMidMaxNeighbours = 8;
+
+	bTimeSlice = false;
+	TimeSliceBudget = 1024;
+	MaxTimeSlices = 4;
+
+	bDeterministic = false;
+}
+
+FFlockStepTimings& FFlockStepTimings::operator+=(const FFlockStepTimings& Other)
+{
+	GridCycles += Other.GridCycles;
+	NeighbourCycles += Other.NeighbourCycles;
+	RulesCycles += Other.RulesCycles;
+	CohesionCycles += Other.CohesionCycles;
+	SeparationCycles += Other.SeparationCycles;
+	AlignmentCycles += Other.AlignmentCycles;
+	KernelCycles += Other.KernelCycles;
+	ContactPushCycles += Other.ContactPushCycles;
+	IntegrateCycles += Other.IntegrateCycles;
+	OrientCycles += Other.OrientCycles;
+	WallCycles += Other.WallCycles;
+	NeighbourCount += Other.NeighbourCount;
+	GatheredCount += Other.GatheredCount;
+	Steps += Other.Steps;
+	VerletRebuilds += Other.VerletRebuilds;
+	return *this;
+}
+
+FFlockSpecies::FFlockSpecies()
+{
+	//Same defaults as FFlockParams
+	const FFlockParams Defaults;
+	SpeedScale = Defaults.SpeedScale;
+	MaxSpeed = Defaults.MaxSpeed;
+	CohesionRate = Defaults.CohesionRate;
+	SeparationLength = Defaults.SeparationLength;
+	SeparationRate = Defaults.SeparationRate;
+	AlignmentRate = Defaults.AlignmentRate;
+	ReOrientRate = Defaults.ReOrientRate;
+}
+
+FFlockSimulation::FFlockSimulation()
+{
+	ObstacleField = nullptr;
+	FlowField = nullptr;
+	bCollectTimings = false;
+	RenderLead = 0.f;
+	FlockCentroid = FVector::ZeroVector;
+	FlockHeading = FVector::ZeroVector;
+	StepCount = 0;
+	TimeSlices = 1;
+	VerletRadius = 0.f;
+	bVerletDirty = true;
+	VerletAge = 0;
+	VerletLifetime = 0;
+}
+
+int32 FFlockSimulation::AddBoid(const FVector& Location, const FVector& Velocity, const FVector& SpawnLocation, uint8 SpeciesIndex)
+{
+	BoidSpecies.Add(SpeciesIndex);
+	Positions.Add(Location);
+	Velocities.Add(Velocity);
+	Orientations.Add(FRotationMatrix::MakeFromX(Velocity.GetSafeNormal()).ToQuat());
+	Avoidance.Add(FVector::ZeroVector);
+	Steering.Add(FVector::ZeroVector);
+	LODTiers.Add(EFlockLODTier::Near);
+	SliceElapsed.Add(0.f);
+	RenderOffsets.Add(FVector::ZeroVector);
+	CorrectionOffsets.Add(FVector::ZeroVector);
+	bVerletDirty = true;
+	return SpawnLocations.Add(SpawnLocation);
+}
+
+void FFlockSimulation::RemoveBoid(int32 Index)
+{
+	check(Positions.IsValidIndex(Index));
+
+	Positions.RemoveAtSwap(Index, 1, false);
+	Velocities.RemoveAtSwap(Index, 1, false);
+	SpawnLocations.RemoveAtSwap(Index, 1, false);
+	Orientations.RemoveAtSwap(Index, 1, false);
+	Avoidance.RemoveAtSwap(Index, 1, false);
+	Steering.RemoveAtSwap(Index, 1, false);
+	LODTiers.RemoveAtSwap(Index, 1, false);
+	SliceElapsed.RemoveAtSwap(Index, 1, false);
+	RenderOffsets.RemoveAtSwap(Index, 1, false);
+	CorrectionOffsets.RemoveAtSwap(Index, 1, false);
+	BoidSpecies.RemoveAtSwap(Index, 1, false);
+	bVerletDirty = true;
+}
+
+void FFlockSimulation::Reset()
+{
+	Positions.Reset();
+	Velocities.Reset();
+	SpawnLocations.Reset();
+	Orientations.Reset();
+	Avoidance.Reset();
+	Steering.Reset();
+	LODTiers.Reset();
+	SliceElapsed.Reset();
+	RenderOffsets.Reset();
+	CorrectionOffsets.Reset();
+	BoidSpecies.Reset();
+	NextPositions.Reset();
+	NextVelocities.Reset();
+	bVerletDirty = true;
+}
+
+void FFlockSimulation::Step(float DeltaTime)
+{
+	const int32 Count = Num();
+	if (Count == 0 || DeltaTime <= 0.f) return;
+
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockStep);
+
+#if STATS
+	const bool bStats = FThreadStats::IsCollectingData();
+#else
+	const bool bStats = false;
+#endif
+	const bool bTimed = bCollectTimings || bStats;
+	const int64 StepStart = bTimed ? FPlatformTime::Cycles64() : 0;
+
+	//Filled by every chunk, then added to Timings and handed to the stats
+	FFlockStepTimings StepTimings;
+
+	UpdateSpecies();
+
+	{
+		FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockGridBuild);
+
+		//Steps that reuse the Verlet lists need no grid at all
+		const bool bVerlet = UsesVerletLists();
+		if (!bVerlet) {
+			bVerletDirty = true;
+		}
+
+		if (!bVerlet || NeedsVerletRebuild()) {
+			//One grid for every species, queries filter by species instead
+			Grid.Build(Positions, ComputeGridCellSize(), SpeciesParams.Num() > 1 ? &BoidSpecies : nullptr);
+
+			if (bVerlet) {
+				BuildVerletLists();
+				StepTimings.VerletRebuilds = 1;
+			}
+		}
+		else {
+			++VerletAge;
+		}
+	}
+
+	if (bTimed) {
+		StepTimings.GridCycles = FPlatformTime::Cycles64() - StepStart;
+	}
+
+	//Views are a local camera, two machines never share them
+	const bool bLOD = Params.bEnableLOD && LODViews.Num() > 0 && !Params.bDeterministic;
+	if (bLOD) {
+		UpdateFlockAverages();
+	}
+
+	//N chosen so that about TimeSliceBudget boids are re-evaluated per step, the cost stays flat as the flock grows
+	TimeSlices = 1;
+	if (Params.bTimeSlice) {
+		TimeSlices = FMath::Clamp(FMath::DivideAndRoundUp(Count, FMath::Max(Params.TimeSliceBudget, 1)), 1, FMath::Max(Params.MaxTimeSlices, 1));
+	}
+
+	NextPositions.SetNumUninitialized(Count, false);
+	NextVelocities.SetNumUninitialized(Count, false);
+
+	//Every boid reads only the previous state and writes only its own slot of the next one,
+	//so the result doesn't depend on how the chunks are spread over threads
+	const int32 NumChunks = FMath::DivideAndRoundUp(Count, StepChunkSize);
+	const bool bSingleThread = CVarFlockParallelStep.GetValueOnAnyThread() == 0;
+
+	const uint32 MidInterval = (uint32)FMath::Max(Params.LODMidRuleInterval, 1);
+	const int32 MidMaxNeighbours = FMath::Max(Params.LODMidMaxNeighbours, 1);
+
+	const uint32 Slices = (uint32)TimeSlices;
+
+	ParallelFor(NumChunks, [this, Count, DeltaTime, bTimed, bLOD, MidInterval, MidMaxNeighbours, Slices, &StepTimings](int32 Chunk) {
+		TRACE_CPUPROFILER_EVENT_SCOPE(FlockStepChunk);
+
+		TArray<int32> Neighbours;
+		TArray<int32> Avoided;
+		FFlockNeighbourBuffer Packed;
+
+		const int32 First = Chunk * StepChunkSize;
+		const int32 Last = FMath::Min(First + StepChunkSize, Count);
+
+		int64 NeighbourCycles = 0, RulesCycles = 0, IntegrateCycles = 0, OrientCycles = 0, NeighbourCount = 0, GatheredCount = 0;
+		//Only the rule breakdown is filled, by ComputeSteering
+		FFlockStepTimings RuleTimings;
+
+		for (int32 Index = First; Index < Last; ++Index) {
+			const int64 Start = bTimed ? FPlatformTime::Cycles64() : 0;
+
+			//Staggered by index so every step re-evaluates the same share of the flock
+			const uint32 Phase = (Index + StepCount) % Slices;
+			if (Phase != 0) {
+				ExtrapolateBoid(Index, DeltaTime, Phase);
+				const int64 Extrapolated = bTimed ? FPlatformTime::Cycles64() : 0;
+
+				OrientBoid(Index, DeltaTime);
+
+				if (bTimed) {
+					IntegrateCycles += Extrapolated - Start;
+					OrientCycles += FPlatformTime::Cycles64() - Extrapolated;
+				}
+				continue;
+			}
+
+			const EFlockLODTier Tier = bLOD ? ComputeLODTier(Index) : EFlockLODTier::Near;
+			LODTiers[Index] = Tier;
+
+			//Only near boids get soft contacts, nobody sees the others overlap
+			FVector Push = FVector::ZeroVector;
+			Neighbours.Reset();
+			Avoided.Reset();
+			//Time slices already space the updates out, mid range boids don't skip any more of them
+			const bool bRunRules = Tier == EFlockLODTier::Near || (Tier == EFlockLODTier::Mid && (Slices > 1 || (Index + StepCount) % MidInterval == 0));
+
+			if (bRunRules) {
+				GatherNeighbours(Index, Tier == EFlockLODTier::Mid ? MidMaxNeighbours : MAX_int32, Neighbours);
+				SplitAvoided(Index, Neighbours, Avoided);
+			}
+			const int64 Gathered = bTimed ? FPlatformTime::Cycles64() : 0;
+
+			if (bRunRules) {
+				FVector RulesPush;
+				Steering[Index] = ComputeSteering(Index, Neighbours, Avoided, Packed, RulesPush, bTimed ? &RuleTimings : nullptr);
+				if (Tier == EFlockLODTier::Near) {
+					Push = RulesPush;
+				}
+			}
+			else if (Tier == EFlockLODTier::Far) {
+				Steering[Index] = CentroidSteering(Index);
+			}
+			const int64 Steered = bTimed ? FPlatformTime::Cycles64() : 0;
+
+			const float SliceTime = SliceElapsed[Index] + DeltaTime;
+			IntegrateBoid(Index, Steering[Index] * GetBoidParams(Index).SpeedScale + Push * Params.ContactStiffness, DeltaTime, SliceTime);
+			const int64 Integrated = bTimed ? FPlatformTime::Cycles64() : 0;
+
+			OrientBoid(Index, DeltaTime);
+
+			if (bTimed) {
+				NeighbourCycles += Gathered - Start;
+				RulesCycles += Steered - Gathered;
+				IntegrateCycles += Integrated - Steered;
+				OrientCycles += FPlatformTime::Cycles64() - Integrated;
+				if (bRunRules) {
+					NeighbourCount += Neighbours.Num() + Avoided.Num();
+					++GatheredCount;
+				}
+			}
+		}
+
+		if (bTimed) {
+			FPlatformAtomics::InterlockedAdd(&StepTimings.NeighbourCycles, NeighbourCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.RulesCycles, RulesCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.IntegrateCycles, IntegrateCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.OrientCycles, OrientCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.CohesionCycles, RuleTimings.CohesionCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.SeparationCycles, RuleTimings.SeparationCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.AlignmentCycles, RuleTimings.AlignmentCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.KernelCycles, RuleTimings.KernelCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.ContactPushCycles, RuleTimings.ContactPushCycles);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.NeighbourCount, NeighbourCount);
+			FPlatformAtomics::InterlockedAdd(&StepTimings.GatheredCount, GatheredCount);
+		}
+	}, bSingleThread);
+
+	Exchange(Positions, NextPositions);
+	Exchange(Velocities, NextVelocities);
+	StepCount++;
+
+	if (bTimed) {
+		StepTimings.WallCycles = FPlatformTime::Cycles64() - StepStart;
+		StepTimings.Steps = 1;
+	}
+	if (bCollectTimings) {
+		Timings += StepTimings;
+	}
+	if (bStats) {
+		PublishStats(StepTimings);
+	}
+}
+
+uint32 FFlockSimulation::ComputeStateHash() const
+{
+	uint32 Hash = FCrc::MemCrc32(Positions.GetData(), Positions.Num() * sizeof(FVector));
+	Hash = FCrc::MemCrc32(Velocities.GetData(), Velocities.Num() * sizeof(FVector), Hash);
+	Hash = FCrc::MemCrc32(SpawnLocations.GetData(), SpawnLocations.Num() * sizeof(FVector), Hash);
+	Hash = FCrc::MemCrc32(Steering.GetData(), Steering.Num() * sizeof(FVector), Hash);
+	Hash = FCrc::MemCrc32(SliceElapsed.GetData(), SliceElapsed.Num() * sizeof(float), Hash);
+	Hash = FCrc::MemCrc32(BoidSpecies.GetData(), BoidSpecies.Num(), Hash);
+	return FCrc::MemCrc32(&StepCount, sizeof(StepCount), Hash);
+}
+
+void FFlockSimulation::PublishStats(const FFlockStepTimings& StepTimings) const
+{
+	//Timings are in Cycles64 units, the stats expect Cycles
+	const double CycleScale = FPlatformTime::GetSecondsPerCycle64() / FPlatformTime::GetSecondsPerCycle();
+
+	//Several flocks and steps may run in a frame, the cycle counters add up
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockNeighbours, StepTimings.NeighbourCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockRules, StepTimings.RulesCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockCohesion, StepTimings.CohesionCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockSeparation, StepTimings.SeparationCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockAlignment, StepTimings.AlignmentCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockKernel, StepTimings.KernelCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockContactPush, StepTimings.ContactPushCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockIntegrate, StepTimings.IntegrateCycles * CycleScale);
+	INC_FLOCK_CYCLE_COUNTER_BY(STAT_FlockOrient, StepTimings.OrientCycles * CycleScale);
+	//Substeps would count the same boids again
+	SET_DWORD_STAT(STAT_FlockBoids, Num());
+	if (UsesVerletLists()) {
+		INC_DWORD_STAT_BY(STAT_FlockVerletRebuilds, StepTimings.VerletRebuilds);
+		SET_DWORD_STAT(STAT_FlockVerletLifetime, VerletLifetime);
+	}
+	//Over the boids that ran their rules, time sliced and far boids gather nobody
+	SET_FLOAT_STAT(STAT_FlockAverageNeighbours, StepTimings.GatheredCount > 0 ? float(StepTimings.NeighbourCount) / StepTimings.GatheredCount : 0.f);
+}
+
+void FFlockSimulation::GatherNeighbours(int32 Index, int32 MaxNeighbours, TArray<int32>& OutNeighbours) const
+{
+	OutNeighbours.Reset();
+
+	//Ignored species are skipped inside the grid, they never reach the rules
+	const uint8 SpeciesIndex = BoidSpecies[Index];
+	const uint32 SpeciesMask = FlockMasks[SpeciesIndex] | AvoidMasks[SpeciesIndex];
+	if (SpeciesMask == 0) return;
+
+	if (Params.bTopological) {
+		const int32 Count = FMath::Min(FMath::Max(Params.TopologicalNeighbours, 1), MaxNeighbours);
+		Grid.QueryNearest(Positions[Index], Count, Params.TopologicalRadius, Params.TopologicalMaxRings, Positions, OutNeighbours, Index, SpeciesMask);
+	}
+	else if (UsesVerletLists()) {
+		//The list is already filtered by species, only the distance has changed since
+		const FVector& Location = Positions[Index];
+		const float RadiusSquared = Params.SensingRadius * Params.SensingRadius;
+		const int32 End = VerletOffsets[Index + 1];
+		for (int32 Slot = VerletOffsets[Index]; Slot < End && OutNeighbours.Num() < MaxNeighbours; ++Slot) {
+			const int32 Other = VerletNeighbours[Slot];
+			if (FVector::DistSquared(Location, Positions[Other]) <= RadiusSquared) {
+				OutNeighbours.Add(Other);
+			}
+		}
+	}
+	else {
+		Grid.Query(Positions[Index], Params.SensingRadius, Positions, OutNeighbours, Index, SpeciesMask);
+		if (OutNeighbours.Num() > MaxNeighbours) {
+			OutNeighbours.SetNum(MaxNeighbours, false);
+		}
+	}
+
+	//The rules add up floats in neighbour order, which otherwise follows the grid's cells.
+	//Topological neighbours lose their nearest first order, only mid range LOD boids need it.
+	if (Params.bDeterministic) {
+		OutNeighbours.Sort();
+	}
+}
+
+bool FFlockSimulation::NeedsVerletRebuild() const
+{
+	if (bVerletDirty || VerletAnchors.Num() != Num() || VerletRadius != GetVerletRadius()) return true;
+	if (VerletFlockMasks != FlockMasks || VerletAvoidMasks != AvoidMasks) return true;
+
+	//Two boids closing in on each other both have to cover half the skin before a missing one gets within SensingRadius
+	const float HalfSkin = 0.5f * FMath::Max(Params.VerletSkin, 0.f);
+	const float LimitSquared = HalfSkin * HalfSkin;
+
+	const int32 Count = Num();
+	for (int32 Index = 0; Index < Count; ++Index) {
+		if (FVector::DistSquared(Positions[Index], VerletAnchors[Index]) > LimitSquared) return true;
+	}
+	return false;
+}
+
+void FFlockSimulation::BuildVerletLists()
+{
+	const int32 Count = Num();
+	const float Radius = GetVerletRadius();
+	const int32 NumChunks = FMath::DivideAndRoundUp(Count, StepChunkSize);
+
+	//Counts first, turned into offsets once every chunk is done
+	VerletOffsets.SetNumUninitialized(Count + 1, false);
+	VerletOffsets[0] = 0;
+
+	//Every chunk fills its own run, the runs are then laid end to end in index order
+	TArray<TArray<int32>> Runs;
+	Runs.SetNum(NumChunks);
+
+	ParallelFor(NumChunks, [this, Count, Radius, &Runs](int32 Chunk) {
+		TArray<int32>& Run = Runs[Chunk];
+
+		const int32 First = Chunk * StepChunkSize;
+		const int32 Last = FMath::Min(First + StepChunkSize, Count);
+
+		for (int32 Index = First; Index < Last; ++Index) {
+			const int32 Before = Run.Num();
+
+			const uint8 SpeciesIndex = BoidSpecies[Index];
+			const uint32 SpeciesMask = FlockMasks[SpeciesIndex] | AvoidMasks[SpeciesIndex];
+			if (SpeciesMask != 0) {
+				Grid.Query(Positions[Index], Radius, Positions, Run, Index, SpeciesMask);
+			}
+
+			VerletOffsets[Index + 1] = Run.Num() - Before;
+		}
+	}, CVarFlockParallelStep.GetValueOnAnyThread() == 0);
+
+	for (int32 Index = 0; Index < Count; ++Index) {
+		VerletOffsets[Index + 1] += VerletOffsets[Index];
+	}
+
+	VerletNeighbours.SetNumUninitialized(VerletOffsets[Count], false);
+	int32 Cursor = 0;
+	for (const TArray<int32>& Run : Runs) {
+		if (Run.Num() > 0) {
+			FMemory::Memcpy(&VerletNeighbours[Cursor], Run.GetData(), Run.Num() * sizeof(int32));
+			Cursor += Run.Num();
+		}
+	}
+
+	VerletAnchors = Positions;
+	VerletRadius = Radius;
+	VerletFlockMasks = FlockMasks;
+	VerletAvoidMasks = AvoidMasks;
+	bVerletDirty = false;
+
+	//Counting the step that builds them
+	VerletLifetime = VerletAge + 1;
+	VerletAge = 0;
+}
+
+void FFlockSimulation::SplitAvoided(int32 Index, TArray<int32>& Neighbours, TArray<int32>& OutAvoided) const
+{
+	OutAvoided.Reset();
+
+	const uint32 AvoidMask = AvoidMasks[BoidSpecies[Index]];
+	if (AvoidMask == 0) return;
+
+	//Order of the flockmates is kept, topological neighbours stay nearest first
+	int32 Kept = 0;
+	for (int32 Other : Neighbours) {
+		if (AvoidMask & (1u << BoidSpecies[Other])) {
+			OutAvoided.Add(Other);
+		}
+		else {
+			Neighbours[Kept++] = Other;
+		}
+	}
+	Neighbours.SetNum(Kept, false);
+}
+
+void FFlockSimulation::UpdateSpecies()
+{
+	SpeciesParams.Reset();
+	FlockMasks.Reset();
+	AvoidMasks.Reset();
+
+	//Without species every boid is species 0 and flocks with every other
+	if (Species.Num() == 0) {
+		SpeciesParams.Add(Params);
+		FlockMasks.Add(MAX_uint32);
+		AvoidMasks.Add(0);
+		FMemory::Memzero(BoidSpecies.GetData(), BoidSpecies.Num());
+		return;
+	}
+
+	const int32 SpeciesCount = FMath::Min(Species.Num(), 32);
+	if (Species.Num() > SpeciesCount) {
+		UE_LOG(LogFlock, Warning, TEXT("Flock has %d species, only the first %d are used"), Species.Num(), SpeciesCount);
+	}
+
+	for (int32 Row = 0; Row < SpeciesCount; ++Row) {
+		const FFlockSpecies& Settings = Species[Row];
+
+		//Flock-wide settings stay, only the rule rates come from the species
+		FFlockParams& RowParams = SpeciesParams.Add_GetRef(Params);
+		RowParams.SpeedScale = Settings.SpeedScale;
+		RowParams.MaxSpeed = Settings.MaxSpeed;
+		RowParams.CohesionRate = Settings.CohesionRate;
+		RowParams.SeparationLength = Settings.SeparationLength;
+		RowParams.SeparationRate = Settings.SeparationRate;
+		RowParams.AlignmentRate = Settings.AlignmentRate;
+		RowParams.ReOrientRate = Settings.ReOrientRate;
+
+		uint32 FlockMask = 0;
+		uint32 AvoidMask = 0;
+		for (int32 Column = 0; Column < SpeciesCount; ++Column) {
+			const EFlockInteraction Interaction = Settings.Interactions.IsValidIndex(Column) ? Settings.Interactions[Column]
+				: (Column == Row ? EFlockInteraction::Flock : EFlockInteraction::Ignore);
+
+			if (Interaction == EFlockInteraction::Flock) {
+				FlockMask |= 1u << Column;
+			}
+			else if (Interaction == EFlockInteraction::Avoid) {
+				AvoidMask |= 1u << Column;
+			}
+		}
+		FlockMasks.Add(FlockMask);
+		AvoidMasks.Add(AvoidMask);
+	}
+
+	//Boids of a species that was removed fall back to the last one
+	const uint8 LastSpecies = (uint8)(SpeciesCount - 1);
+	for (uint8& BoidSpeciesIndex : BoidSpecies) {
+		BoidSpeciesIndex = FMath::Min(BoidSpeciesIndex, LastSpecies);
+	}
+}
+
+float FFlockSimulation::ComputeGridCellSize() const
+{
+	if (!Params.bTopological) return UsesVerletLists() ? GetVerletRadius() : Params.SensingRadius;
+
+	//The cube root below comes from libm, which may round differently on another machine and change
+	//the rings QueryNearest walks. Lockstep flocks use a fixed cell size instead.
+	if (Params.bDeterministic) {
+		return FMath::Clamp(Params.SensingRadius, FMath::Max(Params.ContactRadius, 1.f), FMath::Max(Params.TopologicalRadius, 1.f));
+	}
+
+	//Cells sized to hold about as many boids as we look for, so a collapsed flock gets small cells
+	//and the first rings of QueryNearest stay cheap
+	//Padded by a boid's radius so a flat or single file flock doesn't end up with zero volume
+	const FBox Bounds = FBox(Positions).ExpandBy(FMath::Max(Params.ContactRadius, 1.f));
+	const float VolumePerBoid = Bounds.GetVolume() / Num();
+	const float CellSize = FMath::Pow(VolumePerBoid * FMath::Max(Params.TopologicalNeighbours, 1), 1.f / 3.f);
+
+	return FMath::Clamp(CellSize, FMath::Max(Params.ContactRadius, 1.f), FMath::Max(Params.TopologicalRadius, 1.f));
+}
+
+EFlockLODTier FFlockSimulation::ComputeLODTier(int32 Index) const
+{
+	const FVector& Location = Positions[Index];
+	float NearestSquared = BIG_NUMBER;
+
+	for (const FFlockLODView& View : LODViews) {
+		const FVector ToBoid = Location - View.Location;
+		float DistanceSquared = ToBoid.SizeSquared();
+
+		//Outside the view cone, compared squared to skip the square root
+		const float Along = FVector::DotProduct(ToBoid, View.Direction);
+		if (Along < 0.f || Along * Along < View.CosHalfFOV * View.CosHalfFOV * DistanceSquared) {
+			DistanceSquared *= Params.LODOffscreenScale * Params.LODOffscreenScale;
+		}
+
+		NearestSquared = FMath::Min(NearestSquared, DistanceSquared);
+	}
+
+	if (NearestSquared < Params.LODNearDistance * Params.LODNearDistance) return EFlockLODTier::Near;
+	if (NearestSquared < Params.LODFarDistance * Params.LODFarDistance) return EFlockLODTier::Mid;
+	return EFlockLODTier::Far;
+}
+
+void FFlockSimulation::UpdateFlockAverages()
+{
+	FVector PositionSum = FVector::ZeroVector;
+	FVector VelocitySum = FVector::ZeroVector;
+
+	for (int32 Index = 0; Index < Num(); ++Index) {
+		PositionSum += Positions[Index];
+		VelocitySum += Velocities[Index];
+	}
+
+	FlockCentroid = PositionSum / Num();
+	FlockHeading = FlockMath::SafeNormal(VelocitySum);
+}
+
+FVector FFlockSimulation::CentroidSteering(int32 Index) const
+{
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector TotalVelocity = FlockMath::SafeNormal(GlobalSteering(Index));
+
+	//The whole flock stands in for the neighbours, separation is dropped
+	TotalVelocity += FlockMath::SafeNormal(FlockCentroid - Positions[Index]) * BoidParams.CohesionRate;
+	TotalVelocity += FlockHeading * BoidParams.AlignmentRate;
+
+	return FlockMath::SafeNormal(TotalVelocity);
+}
+
+FVector FFlockSimulation::ComputeSteering(int32 Index, const TArray<int32>& Neighbours, const TArray<int32>& Avoided, FFlockNeighbourBuffer& Packed, FVector& OutContactPush, FFlockStepTimings* OutRuleTimings) const
+{
+	//Same composition as ABoid::Tick, with the obstacle term it had commented out
+	FVector TotalVelocity = GlobalSteering(Index) + (Avoidance[Index] + FieldAvoidance(Index)) * Params.AvoidanceRate;
+	TotalVelocity = FlockMath::SafeNormal(TotalVelocity);
+
+	//Plain cycle reads, a stat scope per rule and boid cost more than some of the rules
+	int64 Mark = OutRuleTimings != nullptr ? FPlatformTime::Cycles64() : 0;
+	auto Lap = [OutRuleTimings, &Mark](int64 FFlockStepTimings::* Cycles) {
+		if (OutRuleTimings != nullptr) {
+			const int64 Now = FPlatformTime::Cycles64();
+			OutRuleTimings->*Cycles += Now - Mark;
+			Mark = Now;
+		}
+	};
+
+	FVector Rules;
+	//The kernel's reciprocal estimates differ between CPUs, and so can the console variable between machines
+	if (CVarFlockSimdKernel.GetValueOnAnyThread() != 0 && !Params.bDeterministic) {
+		Packed.Pack(Neighbours, Positions, Velocities);
+		Rules = FFlockKernel::ComputeRules(Positions[Index], Packed, GetBoidParams(Index), OutContactPush);
+
+		if (CVarFlockValidateKernel.GetValueOnAnyThread() != 0) {
+			const FVector Reference = Cohesion(Index, Neighbours) + Separation(Index, Neighbours) + Alignment(Index, Neighbours);
+			if (!Rules.Equals(Reference, 1.e-3f)) {
+				UE_LOG(LogFlock, Warning, TEXT("Flock kernel mismatch on boid %d: SIMD %s, scalar %s"), Index, *Rules.ToString(), *Reference.ToString());
+			}
+
+			const FVector ReferencePush = ContactPush(Index, Neighbours);
+			if (!OutContactPush.Equals(ReferencePush, 1.e-2f)) {
+				UE_LOG(LogFlock, Warning, TEXT("Flock contact mismatch on boid %d: SIMD %s, scalar %s"), Index, *OutContactPush.ToString(), *ReferencePush.ToString());
+			}
+		}
+		//The scalar check in flock.ValidateKernel is counted with the kernel
+		Lap(&FFlockStepTimings::KernelCycles);
+	}
+	else {
+		Rules = Cohesion(Index, Neighbours);
+		Lap(&FFlockStepTimings::CohesionCycles);
+		Rules += Separation(Index, Neighbours);
+		Lap(&FFlockStepTimings::SeparationCycles);
+		Rules += Alignment(Index, Neighbours);
+		Lap(&FFlockStepTimings::AlignmentCycles);
+		OutContactPush = ContactPush(Index, Neighbours);
+		Lap(&FFlockStepTimings::ContactPushCycles);
+	}
+
+	//Avoided species only push the boid away, and still touch it
+	if (Avoided.Num() > 0) {
+		Rules += Separation(Index, Avoided);
+		Lap(&FFlockStepTimings::SeparationCycles);
+		OutContactPush += ContactPush(Index, Avoided);
+		Lap(&FFlockStepTimings::ContactPushCycles);
+	}
+
+	TotalVelocity += Rules;
+
+	return FlockMath::SafeNormal(TotalVelocity);
+}
+
+void FFlockSimulation::IntegrateBoid(int32 Index, const FVector& Acceleration, float DeltaTime, float SliceTime)
+{
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	//One step over the whole slice, the boid has been coasting on its old velocity since it was last re-evaluated
+	const float Damping = 1.f / (1.f + BoidParams.LinearDamping * SliceTime);
+
+	FVector Velocity = (Velocities[Index] + Acceleration * SliceTime) * Damping;
+	Velocity = FlockMath::ClampedToMaxSize(Velocity, BoidParams.MaxSpeed);
+
+	//Same as Positions + Velocity * SliceTime from where the boid was last re-evaluated
+	const FVector Correction = (Velocity - Velocities[Index]) * (SliceTime - DeltaTime);
+
+	NextVelocities[Index] = Velocity;
+	NextPositions[Index] = Positions[Index] + Velocity * DeltaTime + Correction;
+	SliceElapsed[Index] = 0.f;
+
+	//The view keeps going from where it was and catches up over the next slice, zero when not time slicing
+	RenderOffsets[Index] = -Correction;
+}
+
+void FFlockSimulation::ExtrapolateBoid(int32 Index, float DeltaTime, uint32 Phase)
+{
+	const FVector& Velocity = Velocities[Index];
+
+	NextVelocities[Index] = Velocity;
+	NextPositions[Index] = Positions[Index] + Velocity * DeltaTime;
+	SliceElapsed[Index] += DeltaTime;
+
+	//Linear ease out, the offset is gone on the step before the boid's next re-evaluation
+	const float StepsLeft = float(TimeSlices - (int32)Phase);
+	RenderOffsets[Index] *= (StepsLeft - 1.f) / StepsLeft;
+}
+
+void FFlockSimulation::CorrectBoid(int32 Index, const FVector& Location, const FVector& Velocity)
+{
+	check(Positions.IsValidIndex(Index));
+
+	CorrectionOffsets[Index] += Positions[Index] - Location;
+	Positions[Index] = Location;
+	Velocities[Index] = Velocity;
+}
+
+void FFlockSimulation::DecayCorrections(float DeltaTime, float SmoothingTime)
+{
+	const float Keep = SmoothingTime > 0.f ? FMath::Exp(-DeltaTime / SmoothingTime) : 0.f;
+
+	for (FVector& Offset : CorrectionOffsets) {
+		Offset *= Keep;
+	}
+}
+
+void FFlockSimulation::OrientBoid(int32 Index, float DeltaTime)
+{
+	//Nobody else reads orientations during the step, update in place
+	Orientations[Index] = OrientTowards(Orientations[Index], NextVelocities[Index], GetBoidParams(Index).ReOrientRate, DeltaTime);
+}
+
+FQuat FFlockSimulation::OrientTowards(const FQuat& Current, const FVector& Velocity, float ReOrientRate, float DeltaTime)
+{
+	const FVector Direction = Velocity.GetSafeNormal();
+	if (Direction.IsZero()) return Current;
+
+	const FQuat Target = FRotationMatrix::MakeFromX(Direction).ToQuat();
+
+	//AutoOrient used to run at 30 Hz, compound the same rate over DeltaTime
+	const float Alpha = 1.f - FMath::Pow(1.f - FMath::Clamp(ReOrientRate, 0.f, 1.f), DeltaTime * 30.f);
+
+	return FQuat::Slerp(Current, Target, Alpha).GetNormalized();
+}
+
+FVector FFlockSimulation::Cohesion(int32 Index, const TArray<int32>& Neighbours) const
+{
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector DirectionToClusterMid = FVector::ZeroVector;
+	FVector AveragePosition = FVector::ZeroVector;
+
+	if (Neighbours.Num() > 0) {
+		for (int32 Other : Neighbours) {
+			AveragePosition += Positions[Other];
+		}
+		AveragePosition /= Neighbours.Num();
+		DirectionToClusterMid = AveragePosition - Positions[Index];
+	}
+
+	return FlockMath::SafeNormal(DirectionToClusterMid) * BoidParams.CohesionRate;
+}
+
+FVector FFlockSimulation::Separation(int32 Index, const TArray<int32>& Neighbours) const
+{
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector DirectionAwayFromCrowd = FVector::ZeroVector;
+	float counter = 0.f;
+
+	for (int32 Other : Neighbours) {
+		FVector directionFromOther = Positions[Index] - Positions[Other];
+		float distanceToOther = directionFromOther.Size();
+
+		if (distanceToOther < BoidParams.SeparationLength) {
+			if (distanceToOther == 0.f) distanceToOther = 0.000001f;
+			DirectionAwayFromCrowd += FlockMath::SafeNormal(directionFromOther) * (BoidParams.SeparationRate / distanceToOther);
+			counter++;
+		}
+	}
+	if (counter > 0.f) {
+		DirectionAwayFromCrowd /= counter;
+	}
+
+	return FlockMath::SafeNormal(DirectionAwayFromCrowd) * BoidParams.SeparationRate;
+}
+
+FVector FFlockSimulation::Alignment(int32 Index, const TArray<int32>& Neighbours) const
+{
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector AverageClusterVelocity = FVector::ZeroVector;
+
+	if (Neighbours.Num() > 0) {
+		for (int32 Other : Neighbours) {
+			AverageClusterVelocity += FlockMath::SafeNormal(Velocities[Other]);
+		}
+		AverageClusterVelocity /= Neighbours.Num();
+	}
+
+	return FlockMath::SafeNormal(AverageClusterVelocity) * BoidParams.AlignmentRate;
+}
+
+FVector FFlockSimulation::MoveTowardOrigin(int32 Index) const
+{
+	//Anchors the boid back to spawn point if it moves too far away
+
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector DirectionToSpawn = SpawnLocations[Index] - Positions[Index];
+	float DistanceAway = DirectionToSpawn.SizeSquared();
+
+	if (DistanceAway > (BoidParams.DistanceFromSpawn * BoidParams.DistanceFromSpawn)) {
+		return DirectionToSpawn * BoidParams.ReturnRate;
+	}
+
+	return FVector::ZeroVector;
+}
+
+FVector FFlockSimulation::OrthonormalVelocity(int32 Index) const
+{
+	//Same as ABoid::OrthonormalVelocity, including subtracting the velocity from the spawn point
+
+	const FFlockParams& BoidParams = GetBoidParams(Index);
+
+	FVector Direction = FlockMath::SafeNormal(SpawnLocations[Index] - Velocities[Index]);
+
+	if (BoidParams.VortexClockwise) {
+		Direction = FVector(Direction.Y, -Direction.X, Direction.Z);
+	}
+	else {
+		Direction = FVector(-Direction.Y, Direction.X, Direction.Z);
+	}
+
+	return FlockMath::SafeNormal(Direction) * BoidParams.VortexRate;
+}
+
+FVector FFlockSimulation::ContactPush(int32 Index, const TArray<int32>& Neighbours) const
+{
+	//Stands in for the rigid body contacts of physics driven boids
+
+	FVector Push = FVector::ZeroVector;
+	if (!Params.bKinematic || Params.ContactRadius <= 0.f) return Push;
+
+	const float ContactDistance = 2.f * Params.ContactRadius;
+
+	for (int32 Other : Neighbours) {
+		FVector directionFromOther = Positions[Index] - Positions[Other];
+		float distanceToOther = directionFromOther.Size();
+
+		if (distanceToOther < ContactDistance) {
+			Push += FlockMath::SafeNormal(directionFromOther) * (ContactDistance - distanceToOther);
+		}
+	}
+
+	return Push;
+}
+
+FVector FFlockSimulation::GlobalSteering(int32 Index) const
+{
+	//One lookup for every flow element, the per boid vortex only outside the field.
+	//Return to spawn depends on the boid's own spawn location, so it is never cached.
+	FVector Flow;
+	if (FlowField != nullptr && FlowField->Sample(Positions[Index], Flow)) {
+		return MoveTowardOrigin(Index) + Flow;
+	}
+
+	return MoveTowardOrigin(Index) + OrthonormalVelocity(Index);
+}
+
+FVector FFlockSimulation::FieldAvoidance(int32 Index) const
+{
+	if (ObstacleField == nullptr || Params.FieldAvoidanceDistance <= 0.f) return FVector::ZeroVector;
+
+	FVector Gradient;
+	const float Distance = ObstacleField->Sample(Positions[Index], Gradient);
+
+	if (Distance < Params.FieldAvoidanceDistance) {
+		return FlockMath::SafeNormal(Gradient) * (1.f - Distance / Params.FieldAvoidanceDistance);
+	}
+
+	return FVector::ZeroVector;
+}
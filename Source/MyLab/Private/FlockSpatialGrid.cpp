@@ -0,0 +1,155 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockSpatialGrid.h"
+
+FFlockSpatialGrid::FFlockSpatialGrid()
+{
+	CellSize = 1.f;
+	InvCellSize = 1.f;
+	BucketMask = 0;
+}
+
+void FFlockSpatialGrid::Empty()
+{
+	BucketStart.Empty();
+	SortedIndices.Empty();
+	SortedSpeciesBits.Empty();
+	PointBuckets.Empty();
+	BucketMask = 0;
+}
+
+void FFlockSpatialGrid::Build(const TArray<FVector>& Positions, float NewCellSize, const TArray<uint8>* Species)
+{
+	const int32 Count = Positions.Num();
+
+	CellSize = FMath::Max(NewCellSize, KINDA_SMALL_NUMBER);
+	InvCellSize = 1.f / CellSize;
+
+	//Twice as many buckets as points keeps collisions rare
+	const uint32 BucketCount = FMath::RoundUpToPowerOfTwo(FMath::Max(Count * 2, 64));
+	BucketMask = BucketCount - 1;
+
+	BucketStart.Reset();
+	BucketStart.SetNumZeroed(BucketCount + 1);
+	PointBuckets.SetNumUninitialized(Count, false);
+	SortedIndices.SetNumUninitialized(Count, false);
+
+	//Counting sort, count into the bucket then turn the counts into end offsets
+	for (int32 Index = 0; Index < Count; ++Index) {
+		const uint32 Bucket = GetBucket(GetCell(Positions[Index]));
+		PointBuckets[Index] = Bucket;
+		BucketStart[Bucket]++;
+	}
+	for (uint32 Bucket = 1; Bucket <= BucketCount; ++Bucket) {
+		BucketStart[Bucket] += BucketStart[Bucket - 1];
+	}
+
+	//Filling backwards leaves every offset at the start of its bucket, with indices ascending inside it
+	for (int32 Index = Count - 1; Index >= 0; --Index) {
+		SortedIndices[--BucketStart[PointBuckets[Index]]] = Index;
+	}
+
+	//Kept next to the indices, so filtering doesn't go back to the boid arrays
+	SortedSpeciesBits.Reset();
+	if (Species != nullptr) {
+		SortedSpeciesBits.SetNumUninitialized(Count, false);
+		for (int32 Slot = 0; Slot < Count; ++Slot) {
+			SortedSpeciesBits[Slot] = 1u << (*Species)[SortedIndices[Slot]];
+		}
+	}
+}
+
+void FFlockSpatialGrid::Query(const FVector& Location, float Radius, const TArray<FVector>& Positions, TArray<int32>& OutIndices, int32 ExcludeIndex, uint32 SpeciesMask) const
+{
+	if (SortedIndices.Num() == 0) return;
+
+	const bool bFilter = SpeciesMask != MAX_uint32 && SortedSpeciesBits.Num() > 0;
+
+	const FIntVector Min = GetCell(Location - FVector(Radius));
+	const FIntVector Max = GetCell(Location + FVector(Radius));
+	const float RadiusSquared = Radius * Radius;
+
+	//Different cells can hash to the same bucket, only walk each bucket once
+	TArray<uint32, TInlineAllocator<27>> Visited;
+
+	for (int32 Z = Min.Z; Z <= Max.Z; ++Z) {
+		for (int32 Y = Min.Y; Y <= Max.Y; ++Y) {
+			for (int32 X = Min.X; X <= Max.X; ++X) {
+				const uint32 Bucket = GetBucket(FIntVector(X, Y, Z));
+				if (Visited.Contains(Bucket)) continue;
+				Visited.Add(Bucket);
+
+				for (int32 Slot = BucketStart[Bucket]; Slot < BucketStart[Bucket + 1]; ++Slot) {
+					if (bFilter && (SortedSpeciesBits[Slot] & SpeciesMask) == 0) continue;
+
+					const int32 Other = SortedIndices[Slot];
+					if (Other != ExcludeIndex && FVector::DistSquared(Location, Positions[Other]) <= RadiusSquared) {
+						OutIndices.Add(Other);
+					}
+				}
+			}
+		}
+	}
+}
+
+void FFlockSpatialGrid::QueryNearest(const FVector& Location, int32 Count, float MaxRadius, int32 MaxRings, const TArray<FVector>& Positions, TArray<int32>& OutIndices, int32 ExcludeIndex, uint32 SpeciesMask) const
+{
+	OutIndices.Reset();
+	if (SortedIndices.Num() == 0 || Count <= 0) return;
+
+	const bool bFilter = SpeciesMask != MAX_uint32 && SortedSpeciesBits.Num() > 0;
+
+	//Kept sorted by distance, Count is small so insertion beats a heap
+	TArray<float, TInlineAllocator<32>> BestDistances;
+
+	const FIntVector Center = GetCell(Location);
+	const int32 Rings = FMath::Min(FMath::CeilToInt(MaxRadius * InvCellSize), FMath::Max(MaxRings, 1));
+	//Everything within Rings cells lies in a walked cell. A point found further out through a shared bucket
+	//could have a closer one in a cell that is never walked, so it doesn't count.
+	const float SearchRadius = FMath::Min(MaxRadius, Rings * CellSize);
+	const float SearchRadiusSquared = SearchRadius * SearchRadius;
+
+	for (int32 Ring = 0; Ring <= Rings; ++Ring) {
+		for (int32 Z = -Ring; Z <= Ring; ++Z) {
+			for (int32 Y = -Ring; Y <= Ring; ++Y) {
+				//Only the shell of the cube, the inside was walked by the previous rings
+				const bool bOnShell = FMath::Abs(Z) == Ring || FMath::Abs(Y) == Ring;
+				const int32 Step = bOnShell ? 1 : FMath::Max(2 * Ring, 1);
+
+				for (int32 X = -Ring; X <= Ring; X += Step) {
+					const uint32 Bucket = GetBucket(Center + FIntVector(X, Y, Z));
+
+					for (int32 Slot = BucketStart[Bucket]; Slot < BucketStart[Bucket + 1]; ++Slot) {
+						if (bFilter && (SortedSpeciesBits[Slot] & SpeciesMask) == 0) continue;
+
+						const int32 Other = SortedIndices[Slot];
+						if (Other == ExcludeIndex) continue;
+
+						const float DistanceSquared = FVector::DistSquared(Location, Positions[Other]);
+						if (DistanceSquared > SearchRadiusSquared) continue;
+						if (OutIndices.Num() == Count && DistanceSquared >= BestDistances.Last()) continue;
+
+						//Cells sharing a bucket can hand out the same point twice
+						if (OutIndices.Contains(Other)) continue;
+
+						int32 Insert = BestDistances.Num();
+						while (Insert > 0 && BestDistances[Insert - 1] > DistanceSquared) {
+							Insert--;
+						}
+						if (OutIndices.Num() == Count) {
+							OutIndices.Pop(false);
+							BestDistances.Pop(false);
+						}
+						OutIndices.Insert(Other, Insert);
+						BestDistances.Insert(DistanceSquared, Insert);
+					}
+				}
+			}
+		}
+
+		//Points in the next rings are at least Ring cells away
+		const float Reach = Ring * CellSize;
+		if (OutIndices.Num() == Count && BestDistances.Last() <= Reach * Reach) break;
+	}
+}
@@ -0,0 +1,233 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockTornadoComponent.h"
+#include "FlockSimulation.h"
+#include "FlockStats.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "PhysicsEngine/BodyInstance.h"
+#include "Physics/PhysicsInterfaceCore.h"
+#include "PhysicsPublic.h"
+#include "Async/ParallelFor.h"
+
+// Sets default values for this component's properties
+UFlockTornadoComponent::UFlockTornadoComponent()
+{
+	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
+	// off to improve performance if you don't need them.
+	PrimaryComponentTick.bCanEverTick = true;
+	//Forces have to be in before the physics step
+	PrimaryComponentTick.TickGroup = TG_PrePhysics;
+
+	//Straight up from the actor
+	SetSplinePoints({ FVector::ZeroVector, FVector(0.f, 0.f, 2000.f) }, ESplineCoordinateSpace::Local);
+
+	Strength = 0.5f;
+	CoreRadius = 300.f;
+	Inflow = 0.3f;
+	Lift = 0.5f;
+	bClockwise = false;
+	InfluenceRadius = 2000.f;
+	FunnelSegments = 8;
+
+	WindSpeed = 1500.f;
+	Drag = 2.f;
+	MaxAcceleration = 5000.f;
+	ObjectTypes.Add(UEngineTypes::ConvertToObjectType(ECC_PhysicsBody));
+	MaxBodies = 1024;
+
+	FunnelBounds = FBox(ForceInit);
+	BodiesLastFrame = 0;
+}
+
+// Called when the game starts
+void UFlockTornadoComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	UpdateFunnel();
+}
+
+void UFlockTornadoComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	OverlapHandle = FTraceHandle();
+	Bodies.Reset();
+	BodiesLastFrame = 0;
+}
+
+// Called every frame
+void UFlockTornadoComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	FLOCK_SCOPE_CYCLE_COUNTER(STAT_FlockTornado);
+
+	UWorld* World = GetWorld();
+	if (World == nullptr) return;
+
+	//Last frame's overlap is read before issuing this frame's, the same way as the flock's obstacle traces
+	UpdateFunnel();
+	ConsumeOverlap(World);
+	ApplyForces(World);
+	IssueOverlap(World);
+
+	INC_DWORD_STAT_BY(STAT_FlockTornadoBodies, BodiesLastFrame);
+}
+
+void UFlockTornadoComponent::UpdateFunnel()
+{
+	Funnel.Reset();
+	FunnelBounds = FBox(ForceInit);
+
+	//A spline with a single point is an endless upright funnel
+	const float SplineLength = GetSplineLength();
+	const int32 Stretches = SplineLength > KINDA_SMALL_NUMBER ? FMath::Max(FunnelSegments, 1) : 1;
+
+	FVector Start = GetLocationAtDistanceAlongSpline(0.f, ESplineCoordinateSpace::World);
+	FunnelBounds += Start;
+
+	for (int32 Stretch = 1; Stretch <= Stretches; ++Stretch) {
+		const FVector End = GetLocationAtDistanceAlongSpline(SplineLength * Stretch / Stretches, ESplineCoordinateSpace::World);
+
+		FFlockFlowElement& Element = Funnel.AddDefaulted_GetRef();
+		Element.Type = EFlockFlowElementType::Vortex;
+		Element.Location = Start;
+		Element.Axis = FlockMath::SafeNormal(End - Start);
+		Element.Length = (End - Start).Size();
+		if (Element.Axis.IsZero()) {
+			Element.Axis = FVector::UpVector;
+			Element.Length = 0.f;
+		}
+		Element.Strength = Strength;
+		Element.Radius = CoreRadius;
+		Element.Inflow = Inflow;
+		Element.Lift = Lift;
+		Element.bClockwise = bClockwise;
+
+		FunnelBounds += End;
+		Start = End;
+	}
+}
+
+FVector UFlockTornadoComponent::Evaluate(const FVector& Point) const
+{
+	float Weight;
+	return EvaluateFunnel(Point, Weight);
+}
+
+FVector UFlockTornadoComponent::EvaluateFunnel(const FVector& Point, float& OutWeight) const
+{
+	OutWeight = 0.f;
+
+	//Only the closest stretch, the others would swirl round their own ends on top of it
+	const FFlockFlowElement* Closest = nullptr;
+	float ClosestDistanceSquared = FLT_MAX;
+	for (const FFlockFlowElement& Stretch : Funnel) {
+		const float DistanceSquared = Stretch.Length > 0.f
+			? FMath::PointDistToSegmentSquared(Point, Stretch.Location, Stretch.Location + Stretch.Axis * Stretch.Length)
+			: FMath::Square(FMath::PointDistToLine(Point, Stretch.Axis, Stretch.Location));
+		if (DistanceSquared < ClosestDistanceSquared) {
+			ClosestDistanceSquared = DistanceSquared;
+			Closest = &Stretch;
+		}
+	}
+
+	if (Closest == nullptr || ClosestDistanceSquared >= InfluenceRadius * InfluenceRadius) return FVector::ZeroVector;
+
+	const float Distance = FMath::Sqrt(ClosestDistanceSquared);
+	OutWeight = FMath::Min((InfluenceRadius - Distance) / (0.25f * InfluenceRadius), 1.f);
+
+	return Closest->Evaluate(Point) * OutWeight;
+}
+
+FBox UFlockTornadoComponent::GetInfluenceBounds() const
+{
+	return FunnelBounds.IsValid ? FunnelBounds.ExpandBy(InfluenceRadius) : FBox(ForceInit);
+}
+
+void UFlockTornadoComponent::ConsumeOverlap(UWorld* World)
+{
+	Bodies.Reset();
+
+	FOverlapDatum Datum;
+	if (!OverlapHandle.IsValid() || !World->QueryOverlapData(OverlapHandle, Datum)) return;
+	OverlapHandle = FTraceHandle();
+
+	//A component shows up once per shape, a welded body once per component
+	TSet<FBodyInstance*> Seen;
+	Seen.Reserve(Datum.OutOverlaps.Num());
+
+	for (const FOverlapResult& Overlap : Datum.OutOverlaps) {
+		if (Bodies.Num() >= MaxBodies) break;
+
+		//Destroyed since the overlap was issued
+		UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (Component == nullptr) continue;
+
+		FBodyInstance* Body = Component->GetBodyInstance(NAME_None, true, Overlap.ItemIndex);
+		if (Body == nullptr || !Body->IsValidBodyInstance() || !Body->IsInstanceSimulatingPhysics()) continue;
+
+		bool bAlreadySeen = false;
+		Seen.Add(Body, &bAlreadySeen);
+		if (!bAlreadySeen) {
+			Bodies.Add(Body);
+		}
+	}
+}
+
+void UFlockTornadoComponent::IssueOverlap(UWorld* World)
+{
+	if (Funnel.Num() == 0 || ObjectTypes.Num() == 0 || MaxBodies <= 0) return;
+
+	const FBox Box = GetInfluenceBounds();
+	const FCollisionObjectQueryParams ObjectParams(ObjectTypes);
+	const FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(FlockTornadoOverlap), false, GetOwner());
+
+	OverlapHandle = World->AsyncOverlapByObjectType(Box.GetCenter(), FQuat::Identity, ObjectParams, FCollisionShape::MakeBox(Box.GetExtent()), QueryParams);
+}
+
+void UFlockTornadoComponent::ApplyForces(UWorld* World)
+{
+	const int32 Count = Bodies.Num();
+	BodiesLastFrame = Count;
+
+	FPhysScene* PhysScene = World->GetPhysicsScene();
+	if (Count == 0 || PhysScene == nullptr) return;
+
+	BodyLocations.SetNumUninitialized(Count, false);
+	BodyVelocities.SetNumUninitialized(Count, false);
+	BodyAccelerations.SetNumUninitialized(Count, false);
+
+	//One scene lock for the whole batch instead of one per body and call
+	FPhysicsCommand::ExecuteRead(PhysScene, [this, Count]() {
+		for (int32 Index = 0; Index < Count; ++Index) {
+			BodyLocations[Index] = Bodies[Index]->GetUnrealWorldTransform_AssumesLocked().GetLocation();
+			BodyVelocities[Index] = Bodies[Index]->GetUnrealWorldVelocity_AssumesLocked();
+		}
+	});
+
+	//Bodies are pulled toward the wind's velocity, so they settle into orbit instead of being flung out
+	ParallelFor(FMath::DivideAndRoundUp(Count, ChunkSize), [this, Count](int32 Chunk) {
+		const int32 First = Chunk * ChunkSize;
+		const int32 Last = FMath::Min(First + ChunkSize, Count);
+
+		for (int32 Index = First; Index < Last; ++Index) {
+			float Weight;
+			const FVector Wind = EvaluateFunnel(BodyLocations[Index], Weight) * WindSpeed;
+			BodyAccelerations[Index] = Weight > 0.f
+				? FlockMath::ClampedToMaxSize((Wind - BodyVelocities[Index] * Weight) * Drag, MaxAcceleration)
+				: FVector::ZeroVector;
+		}
+	});
+
+	FPhysicsCommand::ExecuteWrite(PhysScene, [this, PhysScene, Count]() {
+		for (int32 Index = 0; Index < Count; ++Index) {
+			if (!BodyAccelerations[Index].IsZero()) {
+				PhysScene->AddForce_AssumesLocked(Bodies[Index], BodyAccelerations[Index], true, true);
+			}
+		}
+	});
+}
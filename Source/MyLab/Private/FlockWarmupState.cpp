@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FlockWarmupState.h"
+#include "FlockSimulation.h"
+#include "Math/RandomStream.h"
+
+#if WITH_EDITOR
+
+bool UFlockWarmupState::Bake(const FFlockParams& Params, const TArray<FFlockSpecies>& Species, const UFlockObstacleField* ObstacleField, const FVector& Origin, int32 Count, float SpawnRadius, float Seconds, float StepRate)
+{
+	if (Count <= 0 || StepRate <= 0.f) return false;
+
+	FFlockSimulation Simulation;
+	Simulation.Params = Params;
+	Simulation.Species = Species;
+	Simulation.ObstacleField = ObstacleField;
+
+	//Nobody is watching the bake, every boid runs the full rules
+	Simulation.Params.bEnableLOD = false;
+	Simulation.Params.bTimeSlice = false;
+
+	//Fixed seed, baking twice with the same settings gives the same asset
+	FRandomStream Random(Count);
+	for (int32 Index = 0; Index < Count; ++Index) {
+		const FVector Location = Origin + Random.GetUnitVector() * Random.FRandRange(0.f, SpawnRadius);
+		const FVector Velocity = (Location - Origin).GetSafeNormal() * Params.MaxSpeed * Params.ExpandRate;
+		Simulation.AddBoid(Location, Velocity, Origin);
+	}
+
+	const float DeltaTime = 1.f / StepRate;
+	const int32 Steps = FMath::CeilToInt(FMath::Max(Seconds, 0.f) * StepRate);
+	for (int32 Step = 0; Step < Steps; ++Step) {
+		Simulation.Step(DeltaTime);
+	}
+
+	SimulatedSeconds = Steps * DeltaTime;
+
+	Positions.SetNumUninitialized(Count);
+	Velocities = Simulation.Velocities;
+	SpawnOffsets.SetNumUninitialized(Count);
+	Orientations = Simulation.Orientations;
+
+	for (int32 Index = 0; Index < Count; ++Index) {
+		Positions[Index] = Simulation.Positions[Index] - Origin;
+		SpawnOffsets[Index] = Simulation.SpawnLocations[Index] - Origin;
+	}
+
+	MarkPackageDirty();
+	return true;
+}
+
+#endif
@@ -6,6 +6,9 @@
 #include "GameFramework/Actor.h"
 #include "Boid.generated.h"
 
+class AFlockManager;
+class UBoidSnapshotSubsystem;
+
 UCLASS()
 class MYLAB_API ABoid : public AActor
 {
@@ -19,6 +22,7 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void PreRegisterAllComponents() override;
 
 
 public:	
@@ -43,6 +47,23 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void SetSpawnPointLocation(FVector NewSpawnLocation);
 
+	//Hands the boid over to a flock manager, the boid stops ticking and only mirrors the simulation
+	void AttachToFlock(AFlockManager* NewManager, int32 NewFlockIndex);
+
+	//Back to a standalone boid with its own tick and collision, unless it is being torn down
+	void DetachFromFlock();
+
+	//Parks the boid for an ABoidSpawner pool, hidden with no tick, collision or physics
+	void DeactivateToPool();
+
+	//Brings a pooled boid back at Location as a standalone boid, at rest
+	void ActivateFromPool(const FVector& Location);
+
+	FORCEINLINE bool IsPooled() const { return bPooled; }
+
+	//Called by the flock manager every step, the mesh only turns once it is off by more than OrientThreshold radians
+	void UpdateFromFlock(const FVector& Location, const FVector& Velocity, const FQuat& Orientation, float OrientThreshold);
+
 private:
 	//For debugging, drawing line trace on screen
 	UFUNCTION()
@@ -58,7 +79,25 @@ private:
 	FVector OrthonormalVelocity(bool bClockwise);
 
 	UFUNCTION()
-	void AutoOrient();
+	void AutoOrient(float DeltaTime);
+
+	//Steering acceleration of ABoid::Tick, shared by the physics and kinematic paths
+	FVector ComputeSteering();
+
+	//Integrates the boid without a rigid body
+	void KinematicTick(float DeltaTime);
+
+	//Push out of touching boids, replaces the rigid body contacts in kinematic mode
+	FVector ContactPush();
+
+	//Drops the root's rigid body and collision before the components get registered, the sensing sphere stays
+	void ApplyKinematicSettings();
+
+	//Maps Boids to snapshot slots if they went stale, false if the boid has no snapshot yet
+	bool PrepareSnapshot();
+
+	//Rebuilds NeighbourSlots from Boids, called whenever Boids changes
+	void UpdateNeighbourSlots();
 
 	FORCEINLINE void Debug(float Value) {
 		if (GEngine) {
@@ -134,10 +173,53 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "10000.0"))
 	float DistanceFromSpawn;
 
+	//No physics body, the boid integrates its own velocity and only keeps a soft push between touching boids
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Kinematic")
+	bool bKinematic;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Kinematic", meta = (EditCondition = "bKinematic", UIMin = "0.0", UIMax = "10000.0"))
+	float MaxSpeed;
+
+	//Acceleration per unit of penetration
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Kinematic", meta = (EditCondition = "bKinematic", UIMin = "0.0", UIMax = "1000.0"))
+	float ContactStiffness;
+
+	//Set when the boid is driven by a flock manager
+	UPROPERTY(BlueprintReadOnly, Category = "Flock")
+	AFlockManager* Manager;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Flock")
+	int32 FlockIndex;
+
+	//Index into the manager's Species, read when the boid joins a flock
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock", meta = (UIMin = "0", UIMax = "31"))
+	int32 Species;
+
 private:
 	UPROPERTY()
 	FVector SpawnLocation;
 
+	//Last orientation written to MeshParent while driven by a flock manager
+	FQuat FlockOrientation;
+
+	//Frame-coherent positions and velocities the rules read their neighbours from
 	UPROPERTY()
-	FTimerHandle FT_Handle_AutoOrient;
+	UBoidSnapshotSubsystem* Snapshot;
+
+	int32 SnapshotSlot;
+
+	//Snapshot slots of the boids in Boids and their serials, rebuilt when Boids changes or one of the slots is freed
+	TArray<int32> NeighbourSlots;
+	TArray<uint32> NeighbourSerials;
+
+	//Kinematic mode state, rules keep the 10 Hz rate while integration runs every frame
+	FVector KinematicVelocity;
+	FVector KinematicAcceleration;
+	float RuleTimer;
+	float RuleInterval;
+
+	//Set once the tick has been given its random phase
+	bool bTickPhaseSet;
+
+	bool bPooled;
 };
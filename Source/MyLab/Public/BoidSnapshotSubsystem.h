@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "BoidSnapshotSubsystem.generated.h"
+
+class ABoid;
+
+/**
+ * Packed position and velocity of every standalone boid, captured once per frame before any actor ticks.
+ * The rules of ABoid read their neighbours from here instead of asking every neighbour actor,
+ * so each boid's root component and physics body is read once per frame, not once per neighbour.
+ * Every boid stepping in a frame also sees the same state of the flock.
+ */
+UCLASS()
+class MYLAB_API UBoidSnapshotSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	//Returns the boid's slot, slots stay put until the boid unregisters
+	int32 Register(ABoid* Boid);
+
+	void Unregister(int32 Slot);
+
+	//Reads every registered boid, done at the start of every world tick
+	void Capture();
+
+	FORCEINLINE bool IsValidSlot(int32 Slot) const { return Boids.IsValidIndex(Slot) && Boids[Slot] != nullptr; }
+
+	FORCEINLINE const FVector& GetPosition(int32 Slot) const { return Positions[Slot]; }
+
+	FORCEINLINE const FVector& GetVelocity(int32 Slot) const { return Velocities[Slot]; }
+
+	//Changes every time the slot is freed, a slot looked up under an older serial now belongs to another boid or none
+	FORCEINLINE uint32 GetSerial(int32 Slot) const { return Serials[Slot]; }
+
+private:
+	void OnWorldPreActorTick(UWorld* TickedWorld, ELevelTick TickType, float DeltaTime);
+
+//Variables
+private:
+	//Entries are null for free slots
+	UPROPERTY()
+	TArray<ABoid*> Boids;
+
+	TArray<FVector> Positions;
+	TArray<FVector> Velocities;
+	TArray<uint32> Serials;
+
+	TArray<int32> FreeSlots;
+
+	FDelegateHandle PreActorTickHandle;
+};
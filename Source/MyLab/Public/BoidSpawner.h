@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "BoidSpawner.generated.h"
+
+class ABoid;
+class AFlockManager;
+
+/**
+ * Hands out boids from a pool instead of spawning and destroying actors.
+ * The pool is filled and the requested boids are activated a few at a time within FrameBudgetMs,
+ * so a wave of hundreds of boids is spread over frames instead of stalling one.
+ */
+UCLASS()
+class MYLAB_API ABoidSpawner : public AActor
+{
+	GENERATED_BODY()
+	
+public:	
+	// Sets default values for this actor's properties
+	ABoidSpawner();
+
+protected:
+	// Called when the game starts or when spawned
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+public:	
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	//Queues Count boids around SpawnLocation, they are activated over the next frames
+	UFUNCTION(BlueprintCallable, Category = "Spawner")
+	void SpawnBoids(int32 Count, FVector SpawnLocation);
+
+	//Puts a boid back in the pool, use instead of destroying it
+	UFUNCTION(BlueprintCallable, Category = "Spawner")
+	void ReleaseBoid(ABoid* Boid);
+
+	UFUNCTION(BlueprintPure, Category = "Spawner")
+	int32 GetActiveCount() const { return Active.Num(); }
+
+	UFUNCTION(BlueprintPure, Category = "Spawner")
+	int32 GetPooledCount() const { return Pool.Num(); }
+
+	UFUNCTION(BlueprintPure, Category = "Spawner")
+	int32 GetPendingCount() const { return Pending.Num(); }
+
+private:
+	//Constructs one boid and parks it in the pool
+	ABoid* AllocateBoid();
+
+	//Takes a pooled boid, or a new one when the pool is empty and bGrowPool is set
+	ABoid* AcquireBoid();
+
+	void ActivateBoid(ABoid* Boid, const FVector& Location, const FVector& SpawnLocation);
+
+	//Drops active boids that were destroyed instead of released
+	void PruneActive();
+
+//Variables
+public:
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner")
+	TSubclassOf<ABoid> BoidClass;
+
+	//Boids constructed ahead of time, a few per frame from BeginPlay
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner", meta = (UIMin = "0", UIMax = "10000"))
+	int32 PoolSize;
+
+	//Construct more boids when a request finds the pool empty
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner")
+	bool bGrowPool;
+
+	//Time per frame spent filling the pool and activating boids, at least one boid is handled every frame
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner", meta = (UIMin = "0.1", UIMax = "16.0"))
+	float FrameBudgetMs;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner", meta = (UIMin = "0.0", UIMax = "5000.0"))
+	float SpawnRadius;
+
+	//Activated boids join this flock instead of running on their own
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Spawner")
+	AFlockManager* FlockManager;
+
+private:
+	struct FPendingBoid
+	{
+		FVector Location;
+		FVector SpawnLocation;
+	};
+
+	//First in, first out, activated within the frame budget
+	TArray<FPendingBoid> Pending;
+
+	UPROPERTY()
+	TArray<ABoid*> Pool;
+
+	//Weak, someone may destroy a boid instead of releasing it
+	TArray<TWeakObjectPtr<ABoid>> Active;
+};
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "FlockBenchmarkCommandlet.generated.h"
+
+/**
+ * Headless flock scalability benchmark, no world and no rendering needed.
+ * UE4Editor-Cmd MyLab.uproject -run=FlockBenchmark -nullrhi [-Counts=1000,10000,100000] [-Steps=100]
+ *     [-Output=Path.csv|Path.json] [-Scalar] [-SingleThread] [-Seed=1]
+ *     [-TimeSliceBudget=1024] [-TopologicalNeighbours=7] [-Deterministic] [-VerletSkin=50]
+ * Reports microseconds per boid per step for neighbour search, rules and integration,
+ * how often the neighbour grid had to be rebuilt, and the state hash each flock ends up with.
+ */
+UCLASS()
+class UFlockBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UFlockBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
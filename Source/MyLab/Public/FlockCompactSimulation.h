@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockSpatialGrid.h"
+
+struct FFlockParams;
+class FFlockFlowField;
+
+//One boid in 14 bytes: position quantised inside the flock's box, octahedral direction, a fraction of MaxSpeed
+//and which of the flock's spawn points it returns to
+struct FFlockCompactBoid
+{
+	uint16 X, Y, Z;
+	int16 DirectionU, DirectionV;
+	uint16 Speed;
+	uint16 SpawnIndex;
+};
+
+static_assert(sizeof(FFlockCompactBoid) <= 16, "Compact boids must stay under 16 bytes");
+
+/**
+ * Quantised state of a large ambient flock, nothing but FFlockCompactBoid is kept per boid between steps.
+ * A step decodes the flock into scratch arrays, runs the same neighbour rules as FFlockSimulation on them,
+ * quantises the result back and frees the scratch again. Spawn points are shared in a table, tuning lives once
+ * in the FFlockParams handed to Step.
+ */
+class MYLAB_API FFlockCompactSimulation
+{
+public:
+	FFlockCompactSimulation();
+
+	//Positions are quantised inside Origin +- Extent, boids reaching the edge are clamped to it with a warning
+	void Initialize(const FVector& NewOrigin, float NewExtent);
+
+	int32 AddBoid(const FVector& Location, const FVector& Velocity, const FVector& SpawnLocation, float MaxSpeed);
+
+	//Swap-removes a boid, the last boid takes over Index
+	void RemoveBoid(int32 Index);
+
+	void Reset();
+
+	FORCEINLINE int32 Num() const { return Boids.Num(); }
+
+	//FlowField replaces the vortex term where it covers a boid
+	void Step(float DeltaTime, const FFlockParams& Params, const FFlockFlowField* FlowField = nullptr);
+
+	FVector GetPosition(int32 Index) const;
+	FVector GetVelocity(int32 Index, float MaxSpeed) const;
+	FVector GetDirection(int32 Index) const;
+	FVector GetSpawnLocation(int32 Index) const { return SpawnPoints[Boids[Index].SpawnIndex]; }
+
+	//Boids held at the edge of the box by the last step
+	FORCEINLINE int32 GetClampedCount() const { return ClampedCount; }
+
+	FORCEINLINE const FVector& GetOrigin() const { return Origin; }
+
+	//Distance between two neighbouring quantised positions. Steps round to one of the two around the new position
+	//at random, weighted by how close it is, so boids moving less than this per step still move at their speed on average.
+	//Any speed above MaxSpeed / 65535 moves, at the cost of up to this much jitter on each axis.
+	FORCEINLINE float GetPrecision() const { return 2.f * Extent / MAX_uint16; }
+
+private:
+	//Returns false when Location was outside the box and got clamped.
+	//Dither in [0, 1) per axis is added to the position in steps before rounding down, 0.5 rounds to the nearest.
+	bool Encode(FFlockCompactBoid& Boid, const FVector& Location, const FVector& Velocity, float MaxSpeed, const FVector& Dither = FVector(0.5f)) const;
+
+	uint16 FindOrAddSpawnPoint(const FVector& SpawnLocation);
+
+	//Return to spawn plus the vortex, or FlowField where it covers the boid, as FFlockSimulation::GlobalSteering
+	FVector GlobalSteering(int32 Index, const FFlockParams& Params, const FFlockFlowField* FlowField) const;
+
+//Variables
+private:
+	TArray<FFlockCompactBoid> Boids;
+
+	FVector Origin;
+	float Extent;
+
+	//Every distinct spawn location, boids refer to them by index
+	TArray<FVector> SpawnPoints;
+	TMap<FVector, uint16> SpawnPointIndices;
+
+	//Decoded at the start of every step and emptied at its end, the memory is only held while stepping
+	TArray<FVector> Positions;
+	TArray<FVector> Velocities;
+	FFlockSpatialGrid Grid;
+
+	//Seeds the rounding, so the same flock stepped twice ends up in the same place
+	uint32 StepCount;
+
+	int32 ClampedCount;
+	//Clamping is only reported once per Initialize, it keeps happening while the flock leans on the edge
+	bool bWarnedClamped;
+
+	//Boids per ParallelFor task, same as FFlockSimulation
+	static constexpr int32 StepChunkSize = 128;
+};
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+#include "FlockFlowField.generated.h"
+
+UENUM(BlueprintType)
+enum class EFlockFlowElementType : uint8
+{
+	//Swirls round the axis through Location, a Rankine vortex with its core at Radius
+	Vortex,
+	//Pulls toward Location once further than Radius, harder the further away, like ReturnRate
+	Attractor,
+	//The same push everywhere, along Axis
+	Wind
+};
+
+//One source of a flow field. Locations are relative to the flock manager when authored on it.
+USTRUCT(BlueprintType)
+struct MYLAB_API FFlockFlowElement
+{
+	GENERATED_BODY()
+
+	FFlockFlowElement();
+
+	//Contribution of the element at Point, every position in world space
+	FVector Evaluate(const FVector& Point) const;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow")
+	EFlockFlowElementType Type;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (MakeEditWidget))
+	FVector Location;
+
+	//Spin axis of a vortex, direction of the wind
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow")
+	FVector Axis;
+
+	//Vortex only, 0 for an endless axis. Otherwise the axis runs Length from Location and the vortex wraps round its ends.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float Length;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float Strength;
+
+	//Vortex core, the swirl peaks there and falls off as 1/distance outside it. 0 swirls at full strength everywhere.
+	//Attractor dead zone, nothing pulls inside it.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float Radius;
+
+	//Vortex only, pull toward the axis and push along it, as fractions of the swirl
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float Inflow;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow", meta = (UIMin = "-1.0", UIMax = "1.0"))
+	float Lift;
+
+	//Seen looking down the axis, same as FFlockParams::VortexClockwise for an upward axis
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow")
+	bool bClockwise;
+};
+
+/**
+ * Steering vectors cached on a grid around a flock, built once from a few flow elements.
+ * A boid's global steering is then one trilinear lookup instead of a rule per element,
+ * and the grid is small enough to stay in cache while a step walks the flock.
+ */
+class MYLAB_API FFlockFlowField
+{
+public:
+	FFlockFlowField();
+
+	//Evaluates Elements at every cell corner inside InBounds, on worker threads
+	void Build(const FBox& InBounds, float InCellSize, const TArray<FFlockFlowElement>& Elements);
+
+	//Same with any flow, Evaluate is called from worker threads
+	void Build(const FBox& InBounds, float InCellSize, TFunctionRef<FVector(const FVector&)> Evaluate);
+
+	void Reset();
+
+	FORCEINLINE bool IsValid() const { return Vectors.Num() > 0; }
+
+	//Trilinear, false outside the bounds where OutVector is zero and the caller falls back to its own rules
+	bool Sample(const FVector& Location, FVector& OutVector) const;
+
+private:
+	FORCEINLINE int32 GetPointIndex(int32 X, int32 Y, int32 Z) const { return X + Resolution.X * (Y + Resolution.Y * Z); }
+
+//Variables
+public:
+	FBox Bounds;
+	float CellSize;
+	//Points per axis, one more than the cells
+	FIntVector Resolution;
+
+private:
+	//X fastest
+	TArray<FVector> Vectors;
+
+	//Points per axis at most, the bake shrinks its cells to fit
+	static constexpr int32 MaxResolution = 128;
+};
@@ -0,0 +1,32 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FFlockParams;
+
+//Neighbour positions and velocities packed as separate X/Y/Z streams, padded with zeros to a multiple of 4
+struct MYLAB_API FFlockNeighbourBuffer
+{
+	void Pack(const TArray<int32>& Neighbours, const TArray<FVector>& Positions, const TArray<FVector>& Velocities);
+
+	FORCEINLINE int32 Num() const { return Count; }
+
+	TArray<float> PX, PY, PZ;
+	TArray<float> VX, VY, VZ;
+
+private:
+	int32 Count = 0;
+};
+
+/**
+ * Fused cohesion + separation + alignment over packed neighbours, one pass, four neighbours per iteration.
+ * Returns the sum of the three rule vectors, each already scaled by its rate, like
+ * Cohesion() + Separation() + Alignment() on FFlockSimulation, which stay as the scalar reference.
+ * For kinematic flocks the same pass also sums the soft contact push, see FFlockSimulation::ContactPush.
+ */
+struct MYLAB_API FFlockKernel
+{
+	static FVector ComputeRules(const FVector& Location, const FFlockNeighbourBuffer& Neighbours, const FFlockParams& Params, FVector& OutContactPush);
+};
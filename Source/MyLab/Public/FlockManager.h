@@ -0,0 +1,378 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "FlockSimulation.h"
+#include "FlockCompactSimulation.h"
+#include "FlockObstacleTracer.h"
+#include "FlockReplication.h"
+#include "FlockFlowField.h"
+#include "FlockManager.generated.h"
+
+class ABoid;
+class UInstancedStaticMeshComponent;
+class UFlockObstacleField;
+class UFlockWarmupState;
+class UFlockPlaybackClip;
+
+//A gameplay change to a lockstep flock, applied before the step it is scheduled for on every machine
+struct FFlockLockstepEvent
+{
+	enum class EType : uint8
+	{
+		SpawnBoids,
+		SetSpawnLocation,
+		RemoveBoid
+	};
+
+	EType Type;
+	int32 Step;
+	//Boid the event applies to, or the species to spawn
+	int32 Index;
+	int32 Count;
+	FVector Location;
+};
+
+/**
+ * Owns the state of a whole flock and steps it once per frame.
+ * ABoid actors registered here are only views, they stop ticking and just follow the simulation.
+ */
+UCLASS()
+class MYLAB_API AFlockManager : public AActor
+{
+	GENERATED_BODY()
+	
+public:	
+	// Sets default values for this actor's properties
+	AFlockManager();
+
+protected:
+	// Called when the game starts or when spawned
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+public:	
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	//Spawns Count boids of BoidClass around SpawnLocation and adds them to the flock
+	UFUNCTION(BlueprintCallable, Category = "Flock")
+	void SpawnBoids(int32 Count, FVector SpawnLocation, int32 SpeciesIndex = 0);
+
+	//Adds an already spawned boid to the flock as its ABoid::Species, returns its index in the simulation
+	UFUNCTION(BlueprintCallable, Category = "Flock")
+	int32 RegisterBoid(ABoid* Boid, FVector SpawnLocation);
+
+	UFUNCTION(BlueprintCallable, Category = "Flock")
+	void UnregisterBoid(ABoid* Boid);
+
+	UFUNCTION(BlueprintCallable, Category = "Flock")
+	void SetBoidSpawnLocation(int32 Index, FVector NewSpawnLocation);
+
+	UFUNCTION(BlueprintPure, Category = "Flock")
+	int32 GetBoidCount() const { return Simulation.Num() + CompactSimulation.Num(); }
+
+	//Bakes the static geometry inside BakeExtent around the manager into ObstacleField, save the asset afterwards
+	UFUNCTION(CallInEditor, Category = "Avoidance")
+	void BakeObstacleField();
+
+	//Pre-simulates InitialBoidCount boids for WarmupSeconds around the manager into WarmupState, save the asset afterwards
+	UFUNCTION(CallInEditor, Category = "Warm-up")
+	void BakeWarmupState();
+
+	//Records InitialBoidCount boids around the manager into PlaybackClip, save the asset afterwards
+	UFUNCTION(CallInEditor, Category = "Playback")
+	void RecordPlaybackClip();
+
+	//Re-evaluates the flow field from Params, FlowElements and the current nodes and tornadoes
+	UFUNCTION(BlueprintCallable, Category = "Flow Field")
+	void RebuildFlowField();
+
+	//Lockstep versions of SpawnBoids, SetBoidSpawnLocation and removing a boid. Every machine must schedule the same events,
+	//in the same order, before reaching Step. Events for a step already simulated run on the next one and split the flocks.
+	UFUNCTION(BlueprintCallable, Category = "Lockstep")
+	void SpawnBoidsAtStep(int32 Step, int32 Count, FVector SpawnLocation, int32 SpeciesIndex = 0);
+
+	UFUNCTION(BlueprintCallable, Category = "Lockstep")
+	void SetBoidSpawnLocationAtStep(int32 Step, int32 Index, FVector NewSpawnLocation);
+
+	UFUNCTION(BlueprintCallable, Category = "Lockstep")
+	void RemoveBoidAtStep(int32 Step, int32 Index);
+
+	//Steps simulated so far, events scheduled for this step run before the next one
+	UFUNCTION(BlueprintPure, Category = "Lockstep")
+	int32 GetLockstepStep() const { return LockstepStep; }
+
+	//Equal on every machine whose flock is in sync at the same step
+	UFUNCTION(BlueprintPure, Category = "Lockstep")
+	int32 GetStateHash() const { return (int32)Simulation.ComputeStateHash(); }
+
+	FORCEINLINE const FFlockSimulation& GetSimulation() const { return Simulation; }
+	FORCEINLINE const FFlockCompactSimulation& GetCompactSimulation() const { return CompactSimulation; }
+
+private:
+	//Keeps every per-boid array in line when a boid leaves the flock
+	void RemoveBoidAt(int32 Index);
+
+	//Spawns the boids of WarmupState around the manager, already settled
+	void SpawnFromWarmupState();
+
+	//Hands every player's view point to the simulation for its LOD tiers
+	void UpdateLODViews();
+
+	//Writes the simulated transforms back to the boid actors
+	void PushViews();
+
+	//Writes every simulated transform to the instanced mesh in one batch
+	void PushInstances();
+
+	//Same for a compact flock, facing is read straight from the stored direction
+	void PushCompactInstances();
+
+	//Samples PlaybackClip at the current time into the instanced mesh
+	void PushPlaybackInstances();
+
+	//Grows or shrinks the instanced mesh to Count instances in one batch, InstanceTransforms must hold Count transforms
+	void ResizeInstances(int32 Count);
+
+	//Server side, packs the next slice of the flock into NetSnapshot when it is time to send one
+	void UpdateNetSnapshot(float DeltaTime);
+
+	//Client side, matches the server's boid count and corrects the boids in the snapshot
+	UFUNCTION()
+	void OnRep_NetSnapshot();
+
+	//Adds or removes boids at the end of the flock until it has Count
+	void ResizeNetFlock(int32 Count);
+
+	//Runs as many fixed steps as the frame time allows, the frame time never reaches the simulation
+	void TickLockstep(float DeltaTime);
+
+	void ScheduleLockstepEvent(const FFlockLockstepEvent& Event);
+
+	//Runs and drops every event scheduled up to the current step
+	void ApplyLockstepEvents();
+
+	//Random point within SpawnRadius, from the seeded stream in lockstep
+	FVector RandomSpawnOffset();
+
+//Variables
+public:
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock")
+	FFlockParams Params;
+
+	//Kinds of boids sharing this flock's grid, each with its own rates and a row of the interaction matrix.
+	//Empty for a single species flock.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock")
+	TArray<FFlockSpecies> Species;
+
+	//Actor spawned as a view for every boid, leave empty for a view-less flock
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock", meta = (EditCondition = "!bUseInstancedRendering"))
+	TSubclassOf<ABoid> BoidClass;
+
+	//Draws the whole flock through InstancedMesh instead of spawning a boid actor per boid
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Flock")
+	bool bUseInstancedRendering;
+
+	UPROPERTY(BlueprintReadWrite, VisibleAnywhere, Category = "Flock")
+	UInstancedStaticMeshComponent* InstancedMesh;
+
+	//Stores each boid in 14 quantised bytes for very large ambient flocks. Boids run the usual neighbour rules and return
+	//to their spawn point, without obstacle avoidance, species, LOD or time slicing.
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Flock", meta = (EditCondition = "bUseInstancedRendering"))
+	bool bCompactStorage;
+
+	//Half size of the box around the manager compact positions are quantised in, precision is 2 * CompactExtent / 65535.
+	//Slower boids still move, positions are rounded at random in proportion, see FFlockCompactSimulation::GetPrecision.
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Flock", meta = (EditCondition = "bCompactStorage", UIMin = "100.0", UIMax = "100000.0"))
+	float CompactExtent;
+
+	//Boid actor meshes are only turned once their orientation is off by more than this, in degrees
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock", meta = (UIMin = "0.0", UIMax = "45.0"))
+	float OrientThreshold;
+
+	//Async whisker traces, weighted by Params.AvoidanceRate
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance")
+	bool bAvoidObstacles;
+
+	//Object type the whiskers look for, WorldStatic by default so they never hit the boids
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance", meta = (EditCondition = "bAvoidObstacles"))
+	TEnumAsByte<ECollisionChannel> TraceChannel;
+
+	//Upper bound on traces issued per frame, whatever the flock size
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance", meta = (EditCondition = "bAvoidObstacles", UIMin = "2", UIMax = "1024"))
+	int32 MaxTracesPerFrame;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance", meta = (EditCondition = "bAvoidObstacles", UIMin = "0.0", UIMax = "1.0"))
+	float MinRetraceInterval;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance", meta = (EditCondition = "bAvoidObstacles", UIMin = "0.0", UIMax = "5.0"))
+	float MaxRetraceInterval;
+
+	//Baked signed distance field, sampled instead of tracing, one asset per map
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Avoidance")
+	UFlockObstacleField* ObstacleField;
+
+	//Half size of the box baked around the manager
+	UPROPERTY(EditAnywhere, Category = "Avoidance")
+	FVector BakeExtent;
+
+	UPROPERTY(EditAnywhere, Category = "Avoidance", meta = (UIMin = "10.0", UIMax = "500.0"))
+	float BakeVoxelSize;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock", meta = (UIMin = "0", UIMax = "10000"))
+	int32 InitialBoidCount;
+
+	//Loaded at BeginPlay instead of spawning InitialBoidCount boids at the manager
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Warm-up")
+	UFlockWarmupState* WarmupState;
+
+	UPROPERTY(EditAnywhere, Category = "Warm-up", meta = (UIMin = "0.0", UIMax = "120.0"))
+	float WarmupSeconds;
+
+	//Steps per second of the bake
+	UPROPERTY(EditAnywhere, Category = "Warm-up", meta = (UIMin = "10.0", UIMax = "120.0"))
+	float WarmupStepRate;
+
+	//Plays the clip through InstancedMesh instead of simulating, the flock no longer reacts to anything
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Playback")
+	UFlockPlaybackClip* PlaybackClip;
+
+	//Seconds into the clip this manager starts at, so managers sharing a clip play out of phase
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Playback")
+	float PlaybackTimeOffset;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Playback", meta = (UIMin = "0.0", UIMax = "4.0"))
+	float PlaybackRate;
+
+	//Length of the loop recorded by RecordPlaybackClip, the boids settle for WarmupSeconds first
+	UPROPERTY(EditAnywhere, Category = "Playback", meta = (UIMin = "1.0", UIMax = "120.0"))
+	float RecordDuration;
+
+	//Keyframes per second, playback interpolates in between
+	UPROPERTY(EditAnywhere, Category = "Playback", meta = (UIMin = "1.0", UIMax = "30.0"))
+	float RecordFrameRate;
+
+	//Cross-fade from the end of the loop back into its start
+	UPROPERTY(EditAnywhere, Category = "Playback", meta = (UIMin = "0.0", UIMax = "10.0"))
+	float RecordBlendSeconds;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flock", meta = (UIMin = "0.0", UIMax = "5000.0"))
+	float SpawnRadius;
+
+	//The server sends the flock to clients, which spawn no boids of their own and follow it instead.
+	//Compact and played back flocks always run locally.
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Replication")
+	bool bReplicateFlock;
+
+	//Per client, whatever the flock size. Bigger flocks are just corrected less often.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Replication", meta = (EditCondition = "bReplicateFlock", UIMin = "256", UIMax = "65536"))
+	int32 NetBytesPerSecond;
+
+	//Snapshots per second when no player is within NetRelevantDistance
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Replication", meta = (EditCondition = "bReplicateFlock", UIMin = "0.5", UIMax = "30.0"))
+	float MinNetSendRate;
+
+	//Snapshots per second when a player is at the manager, the bytes are split over more, smaller snapshots
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Replication", meta = (EditCondition = "bReplicateFlock", UIMin = "0.5", UIMax = "30.0"))
+	float MaxNetSendRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Replication", meta = (EditCondition = "bReplicateFlock", UIMin = "100.0", UIMax = "100000.0"))
+	float NetRelevantDistance;
+
+	//Time for a client boid to ease most of the way to a server correction
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Replication", meta = (EditCondition = "bReplicateFlock", UIMin = "0.0", UIMax = "2.0"))
+	float NetSmoothingTime;
+
+	//The vortex comes from one lookup in a field cached around the manager, instead of a rule run per boid. The field holds
+	//the vortex of Params round the manager, FlowElements, FlowFieldNodes and FlowFieldTornadoes. Return to spawn stays per boid.
+	//Boids outside it fall back to the per boid rules.
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Flow Field")
+	bool bUseFlowField;
+
+	//Half size of the box around the manager the field covers
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField"))
+	FVector FlowFieldExtent;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField", UIMin = "25.0", UIMax = "1000.0"))
+	float FlowFieldCellSize;
+
+	//Extra vortices, attractors and wind, relative to the manager
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField"))
+	TArray<FFlockFlowElement> FlowElements;
+
+	//Actors along a vortex axis, e.g. the nodes of a tornado. The field swirls round the line through them in order.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField"))
+	TArray<AActor*> FlowFieldNodes;
+
+	//Strength, core, inflow, lift and direction of the vortex along FlowFieldNodes, also its axis when there is a single node
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField"))
+	FFlockFlowElement NodeVortex;
+
+	//Actors with a UFlockTornadoComponent, the flock is swept up by each funnel
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField"))
+	TArray<AActor*> FlowFieldTornadoes;
+
+	//Seconds between rebuilds, for nodes and tornadoes that move. 0 only builds at BeginPlay and on RebuildFlowField.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Flow Field", meta = (EditCondition = "bUseFlowField", UIMin = "0.0", UIMax = "5.0"))
+	float FlowFieldRebuildInterval;
+
+	//Every machine steps the same flock from LockstepSeed at a fixed rate, nothing is sent. Params, Species and
+	//the obstacle field must match everywhere, and gameplay may only change the flock through the AtStep functions.
+	//Obstacle traces and LOD are off, compact and played back flocks don't take part.
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Lockstep")
+	bool bLockstep;
+
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Lockstep", meta = (EditCondition = "bLockstep", UIMin = "10.0", UIMax = "120.0"))
+	float LockstepStepRate;
+
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category = "Lockstep", meta = (EditCondition = "bLockstep"))
+	int32 LockstepSeed;
+
+	//A machine further behind than this drops the time instead of catching up, it stays in sync but runs late
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Lockstep", meta = (EditCondition = "bLockstep", UIMin = "1", UIMax = "16"))
+	int32 MaxLockstepStepsPerFrame;
+
+private:
+	//Parallel to the simulation arrays, entries can be null
+	UPROPERTY()
+	TArray<ABoid*> Views;
+
+	FFlockSimulation Simulation;
+
+	//Used instead of Simulation when bCompactStorage is set
+	FFlockCompactSimulation CompactSimulation;
+
+	FFlockObstacleTracer ObstacleTracer;
+
+	float PlaybackTime;
+
+	UPROPERTY(ReplicatedUsing = OnRep_NetSnapshot)
+	FFlockNetSnapshot NetSnapshot;
+
+	float NetSendTimer;
+
+	//First boid of the next snapshot
+	int32 NetNextIndex;
+
+	//Shared by the full and the compact simulation
+	FFlockFlowField FlowField;
+
+	float FlowFieldTimer;
+
+	//Only drawn from in lockstep, for spawn positions
+	FRandomStream LockstepRandom;
+
+	float LockstepAccumulator;
+	int32 LockstepStep;
+
+	//Sorted by step, events of one step keep the order they were scheduled in
+	TArray<FFlockLockstepEvent> LockstepEvents;
+
+	//Reused every frame for the batched instance update
+	TArray<FTransform> InstanceTransforms;
+};
@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "FlockObstacleField.generated.h"
+
+/**
+ * Signed distance to the static geometry of a level, baked on a voxel grid.
+ * Boids sample it trilinearly instead of tracing the scene, so avoidance is a memory lookup
+ * that is safe to run on worker threads. Bake one per map from a flock manager and save it.
+ */
+UCLASS(BlueprintType)
+class MYLAB_API UFlockObstacleField : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	//Signed distance in cm, negative inside geometry. OutGradient points away from the closest surface.
+	//Outside the baked bounds the field reports BIG_NUMBER and a zero gradient.
+	float Sample(const FVector& Location, FVector& OutGradient) const;
+
+	UFUNCTION(BlueprintPure, Category = "Obstacle Field")
+	float SampleDistance(FVector Location) const;
+
+	FORCEINLINE bool IsValid() const { return Distances.Num() > 0 && Distances.Num() == Resolution.X * Resolution.Y * Resolution.Z; }
+
+#if WITH_EDITOR
+	//Voxelises the static geometry of World inside InBounds, then runs a distance transform over it
+	bool Bake(UWorld* World, const FBox& InBounds, float InVoxelSize);
+#endif
+
+private:
+	FORCEINLINE int32 GetVoxelIndex(int32 X, int32 Y, int32 Z) const { return X + Resolution.X * (Y + Resolution.Y * Z); }
+
+//Variables
+public:
+	UPROPERTY(VisibleAnywhere, Category = "Obstacle Field")
+	FBox Bounds;
+
+	UPROPERTY(VisibleAnywhere, Category = "Obstacle Field")
+	float VoxelSize;
+
+	UPROPERTY(VisibleAnywhere, Category = "Obstacle Field")
+	FIntVector Resolution;
+
+private:
+	//Signed distance at every voxel centre, X fastest
+	UPROPERTY()
+	TArray<float> Distances;
+};
@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "WorldCollision.h"
+
+class FFlockSimulation;
+class UWorld;
+
+/**
+ * Obstacle avoidance for a flock through async whisker traces.
+ * Traces issued on one frame are read back on the next, and each boid is only re-traced when it is due,
+ * sooner when it is fast or has just hit something, within a fixed number of traces per frame.
+ */
+class MYLAB_API FFlockObstacleTracer
+{
+public:
+	FFlockObstacleTracer();
+
+	//Reads last frame's results into the simulation's Avoidance, then issues this frame's traces
+	void Update(UWorld* World, FFlockSimulation& Simulation, const FCollisionQueryParams& QueryParams);
+
+	//Keeps the per-boid state in line with FFlockSimulation::RemoveBoid
+	void RemoveBoid(int32 Index);
+
+	void Reset();
+
+	FORCEINLINE int32 GetTracesLastFrame() const { return TracesLastFrame; }
+
+	//Whether Update has run since the last Reset
+	FORCEINLINE bool IsTracking() const { return NextTraceTime.Num() > 0; }
+
+private:
+	void ConsumeResults(UWorld* World, FFlockSimulation& Simulation, float Now);
+	void IssueTraces(UWorld* World, const FFlockSimulation& Simulation, const FCollisionQueryParams& QueryParams, float Now);
+
+//Variables
+public:
+	//Object type the whiskers hit, WorldStatic by default. Boids are never that type, so they can't hit themselves or each other.
+	ECollisionChannel ObjectType;
+
+	int32 MaxTracesPerFrame;
+
+	//Bounds of the per-boid re-trace interval
+	float MinRetraceInterval;
+	float MaxRetraceInterval;
+
+	//Angle of the side whisker, alternating left and right on every trace
+	float WhiskerAngle;
+
+private:
+	struct FPendingTrace
+	{
+		FTraceHandle Handle;
+		int32 BoidIndex;
+		bool bFirstWhisker;
+	};
+
+	TArray<FPendingTrace> PendingTraces;
+
+	TArray<float> NextTraceTime;
+	TArray<float> LastHitTime;
+	TArray<bool> bLeftWhisker;
+
+	//Round robin start of the next scan, so every boid gets its turn when the budget is tight
+	int32 Cursor;
+	int32 TracesLastFrame;
+};
@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "FlockPlaybackClip.generated.h"
+
+struct FFlockParams;
+struct FFlockSpecies;
+class UFlockObstacleField;
+
+/**
+ * A looping window of flock simulation recorded as quantised keyframes, for scenery flocks nobody interacts with.
+ * Playback only interpolates between two keyframes per boid, facing turns smoothly between the headings through them.
+ * Positions are relative to the flock origin, so several managers can play one clip at different places and times.
+ */
+UCLASS(BlueprintType)
+class MYLAB_API UFlockPlaybackClip : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	FORCEINLINE bool IsValid() const { return BoidCount > 0 && FrameCount > 1 && FrameRate > 0.f && Frames.Num() == BoidCount * FrameCount * 3; }
+
+	FORCEINLINE float GetDuration() const { return FrameCount / FrameRate; }
+
+	//Position relative to the origin and facing of a boid, Time wraps around the loop
+	void Sample(int32 Boid, float Time, FVector& OutLocation, FQuat& OutOrientation) const;
+
+#if WITH_EDITOR
+	//Settles Count boids for SettleSeconds, then records Duration seconds at InFrameRate.
+	//BlendSeconds more are recorded and cross-faded into the first frames so the clip loops without a jump.
+	//Boids are of the first species, like UFlockWarmupState::Bake.
+	bool Record(const FFlockParams& Params, const TArray<FFlockSpecies>& Species, const UFlockObstacleField* ObstacleField, const FVector& Origin, int32 Count, float SpawnRadius,
+		float SettleSeconds, float Duration, float InFrameRate, float BlendSeconds);
+#endif
+
+private:
+	FORCEINLINE FVector GetFramePosition(int32 Frame, int32 Boid) const
+	{
+		const int32 Offset = (Frame * BoidCount + Boid) * 3;
+		const FVector Local(Frames[Offset], Frames[Offset + 1], Frames[Offset + 2]);
+		return Bounds.Min + Local * (Bounds.GetSize() / MAX_uint16);
+	}
+
+	//Facing along the path through the keyframe, from the keyframes either side of it
+	FQuat GetFrameOrientation(int32 Frame, int32 Boid) const;
+
+//Variables
+public:
+	UPROPERTY(VisibleAnywhere, Category = "Playback")
+	int32 BoidCount;
+
+	UPROPERTY(VisibleAnywhere, Category = "Playback")
+	int32 FrameCount;
+
+	UPROPERTY(VisibleAnywhere, Category = "Playback")
+	float FrameRate;
+
+	//Quantisation box, relative to the flock origin
+	UPROPERTY(VisibleAnywhere, Category = "Playback")
+	FBox Bounds;
+
+private:
+	//X, Y, Z of every boid of frame 0, then frame 1 and so on, 16 bits each inside Bounds
+	UPROPERTY()
+	TArray<uint16> Frames;
+};
@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+#include "FlockReplication.generated.h"
+
+class FFlockSimulation;
+
+//One boid of a snapshot, already quantised. Packed into FFlockNetSnapshot::BoidBits on the wire.
+struct FFlockNetBoid
+{
+	//Offset from the centroid, 0 to PositionMax across the snapshot's box
+	uint16 X, Y, Z;
+	//Fraction of MaxSpeed, biased by VelocityMax so 0 is full speed backwards
+	uint8 VelocityX, VelocityY, VelocityZ;
+	uint8 Species;
+};
+
+/**
+ * A slice of the server flock, sent as one bit-packed property.
+ * Positions are offsets from the flock centroid inside a box just big enough for the slice, velocities a fraction of MaxSpeed.
+ * Consecutive snapshots walk round the flock, so every boid is corrected in turn whatever the flock size.
+ */
+USTRUCT()
+struct MYLAB_API FFlockNetSnapshot
+{
+	GENERATED_BODY()
+
+	FFlockNetSnapshot();
+
+	//Quantises Count boids of Simulation from StartIndex on, wrapping round to index 0
+	void Build(const FFlockSimulation& Simulation, int32 StartIndex, int32 Count, float Time);
+
+	FORCEINLINE int32 Num() const { return Boids.Num(); }
+
+	//Server index of the boid in Slot
+	FORCEINLINE int32 GetIndex(int32 Slot) const { return (FirstIndex + Slot) % BoidCount; }
+
+	FVector GetPosition(int32 Slot) const;
+	FVector GetVelocity(int32 Slot) const;
+
+	//Bits every boid costs on the wire
+	FORCEINLINE int32 GetBoidBits() const { return bHasSpecies ? BoidBits + SpeciesBits : BoidBits; }
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+//Variables
+public:
+	//Bumped by Build. Replication only compares UPROPERTYs, this is what tells it a new snapshot is waiting.
+	UPROPERTY()
+	uint16 Sequence;
+
+	//Server world time the snapshot was taken at
+	float ServerTime;
+
+	FVector_NetQuantize Centroid;
+
+	//Half size of the box around Centroid positions are quantised in
+	float Extent;
+
+	float MaxSpeed;
+
+	//Boids in the whole server flock
+	int32 BoidCount;
+
+	//Server index of the boid in slot 0
+	int32 FirstIndex;
+
+	//Only multi species flocks send the species of every boid
+	bool bHasSpecies;
+
+	TArray<FFlockNetBoid> Boids;
+
+	static constexpr int32 PositionBits = 12;
+	static constexpr int32 VelocityBits = 8;
+	static constexpr int32 SpeciesBits = 5;
+	static constexpr uint32 PositionMax = (1u << PositionBits) - 1;
+	static constexpr uint32 VelocityMax = (1u << (VelocityBits - 1)) - 1;
+	static constexpr int32 BoidBits = 3 * (PositionBits + VelocityBits);
+
+	//Upper bound on everything sent before the boids
+	static constexpr int32 HeaderBits = 256;
+};
+
+template<>
+struct TStructOpsTypeTraits<FFlockNetSnapshot> : public TStructOpsTypeTraitsBase2<FFlockNetSnapshot>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
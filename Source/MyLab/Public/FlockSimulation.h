@@ -0,0 +1,470 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockSpatialGrid.h"
+#include "FlockKernel.h"
+#include "FlockSimulation.generated.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(LogFlock, Log, All);
+
+class UFlockObstacleField;
+class FFlockFlowField;
+
+namespace FlockMath
+{
+	//GetSafeNormal through a correctly rounded square root. FVector's InvSqrt is an estimate
+	//whose last bits differ between CPU vendors, enough to split two lockstep machines apart.
+	FORCEINLINE FVector SafeNormal(const FVector& Vector)
+	{
+		const float SizeSquared = Vector.SizeSquared();
+		if (SizeSquared < SMALL_NUMBER) return FVector::ZeroVector;
+
+		return Vector * (1.f / FMath::Sqrt(SizeSquared));
+	}
+
+	//Same for GetClampedToMaxSize
+	FORCEINLINE FVector ClampedToMaxSize(const FVector& Vector, float MaxSize)
+	{
+		const float SizeSquared = Vector.SizeSquared();
+		if (SizeSquared <= MaxSize * MaxSize) return Vector;
+
+		return Vector * (MaxSize / FMath::Sqrt(SizeSquared));
+	}
+}
+
+//Tuning shared by every boid of a flock, same meaning as the per-actor stats on ABoid
+USTRUCT(BlueprintType)
+struct MYLAB_API FFlockParams
+{
+	GENERATED_BODY()
+
+	FFlockParams();
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats")
+	float SpeedScale;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float CohesionRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1000.0"))
+	float SeparationLength;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float SeparationRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float AlignmentRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float ExpandRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float ReturnRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float VortexRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats")
+	bool VortexClockwise;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float DistanceFromSpawn;
+
+	//Fraction of the way to the velocity direction turned every 1/30 s, like ABoid::AutoOrient
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float ReOrientRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float AvoidanceRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float TraceLength;
+
+	//Boids closer than this to baked obstacle field geometry steer away from it
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "2000.0"))
+	float FieldAvoidanceDistance;
+
+	//Radius of the old SensingSphere
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "2000.0"))
+	float SensingRadius;
+
+	//Rules see the TopologicalNeighbours nearest boids instead of every boid within SensingRadius,
+	//so a boid's cost stays bounded however tightly the flock packs
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats")
+	bool bTopological;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (EditCondition = "bTopological", UIMin = "1", UIMax = "32"))
+	int32 TopologicalNeighbours;
+
+	//Boids further than this never count as neighbours, even when fewer than TopologicalNeighbours are found
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (EditCondition = "bTopological", UIMin = "0.0", UIMax = "5000.0"))
+	float TopologicalRadius;
+
+	//Rings of grid cells the nearest search walks out at most, bounding its cost when cells are small next to
+	//TopologicalRadius. Neighbours are only looked for within this many cells, a sparse flock may see fewer.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (EditCondition = "bTopological", UIMin = "1", UIMax = "16"))
+	int32 TopologicalMaxRings;
+
+	//Neighbour lists are searched out to SensingRadius plus VerletSkin and reused across steps, until some boid
+	//has moved half the skin since they were built. Steps in between skip the grid altogether. Not used in topological mode.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (EditCondition = "!bTopological"))
+	bool bVerletLists;
+
+	//Wider skins rebuild less often but filter more candidates every step
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (EditCondition = "bVerletLists", UIMin = "0.0", UIMax = "1000.0"))
+	float VerletSkin;
+
+	//Replaces the rigid body's damping and keeps the integrated speed bounded
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float MaxSpeed;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Stats", meta = (UIMin = "0.0", UIMax = "10.0"))
+	float LinearDamping;
+
+	//No physics body per boid, overlapping boids are pushed apart by a soft contact force instead
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Kinematic")
+	bool bKinematic;
+
+	//Radius of a boid for the soft contacts, same as the RootSphere default
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Kinematic", meta = (EditCondition = "bKinematic", UIMin = "0.0", UIMax = "200.0"))
+	float ContactRadius;
+
+	//Acceleration per unit of penetration
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Kinematic", meta = (EditCondition = "bKinematic", UIMin = "0.0", UIMax = "1000.0"))
+	float ContactStiffness;
+
+	//Cheaper rules for boids far from every view, only used when the simulation is given view points
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD")
+	bool bEnableLOD;
+
+	//Boids closer than this to a view run the full rules every step
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD", meta = (EditCondition = "bEnableLOD", UIMin = "0.0", UIMax = "50000.0"))
+	float LODNearDistance;
+
+	//Boids further than this only follow the flock centroid, in between they run reduced rules
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD", meta = (EditCondition = "bEnableLOD", UIMin = "0.0", UIMax = "100000.0"))
+	float LODFarDistance;
+
+	//Distance to a view is multiplied by this for boids outside its field of view
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD", meta = (EditCondition = "bEnableLOD", UIMin = "1.0", UIMax = "10.0"))
+	float LODOffscreenScale;
+
+	//Mid range boids re-run their rules every this many steps and keep the last steering in between, ignored while time slicing
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD", meta = (EditCondition = "bEnableLOD", UIMin = "1", UIMax = "10"))
+	int32 LODMidRuleInterval;
+
+	//Mid range boids only use this many of their neighbours, the nearest ones in topological mode
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "LOD", meta = (EditCondition = "bEnableLOD", UIMin = "1", UIMax = "64"))
+	int32 LODMidMaxNeighbours;
+
+	//Only a slice of the flock is re-evaluated every step, the other boids coast on their last velocity
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Time Slicing")
+	bool bTimeSlice;
+
+	//Boids re-evaluated per step, the number of slices follows from the flock size
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Time Slicing", meta = (EditCondition = "bTimeSlice", UIMin = "1", UIMax = "100000"))
+	int32 TimeSliceBudget;
+
+	//Every boid is re-evaluated at least once every this many steps, whatever the budget
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Time Slicing", meta = (EditCondition = "bTimeSlice", UIMin = "1", UIMax = "16"))
+	int32 MaxTimeSlices;
+
+	//Steps come out bit-identical on every machine running the same build, given the same inputs and DeltaTime.
+	//Runs the scalar rules with neighbours in index order, and ignores LOD views. Topological grids use SensingRadius cells.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Lockstep")
+	bool bDeterministic;
+};
+
+//How boids of one species react to boids of another
+UENUM(BlueprintType)
+enum class EFlockInteraction : uint8
+{
+	//Cohesion, separation and alignment, as within a species
+	Flock,
+	//Only kept apart by separation
+	Avoid,
+	//Never seen as neighbours
+	Ignore
+};
+
+//A kind of boid sharing a flock's spatial grid with other kinds, overrides the flock's rule rates
+USTRUCT(BlueprintType)
+struct MYLAB_API FFlockSpecies
+{
+	GENERATED_BODY()
+
+	FFlockSpecies();
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species")
+	FName Name;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species")
+	float SpeedScale;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float MaxSpeed;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float CohesionRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "1000.0"))
+	float SeparationLength;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float SeparationRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float AlignmentRate;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float ReOrientRate;
+
+	//Row of the interaction matrix, entry i is how this species treats species i.
+	//Missing entries mean Flock for the species itself and Ignore for the others.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Species")
+	TArray<EFlockInteraction> Interactions;
+};
+
+enum class EFlockLODTier : uint8
+{
+	//Full rules every step
+	Near,
+	//Rules every LODMidRuleInterval steps with at most LODMidMaxNeighbours neighbours
+	Mid,
+	//No neighbour search, steers toward the flock centroid and heading
+	Far
+};
+
+//A point the flock is seen from, usually a player camera
+struct FFlockLODView
+{
+	FVector Location;
+	FVector Direction;
+	//Cosine of half the field of view, boids outside the cone count as off screen
+	float CosHalfFOV;
+};
+
+//Cycles spent in each phase of Step, summed over every worker thread.
+//Only measured when bCollectTimings is set or "stat Flock" is on.
+struct MYLAB_API FFlockStepTimings
+{
+	int64 GridCycles = 0;
+	int64 NeighbourCycles = 0;
+	int64 RulesCycles = 0;
+	//Share of RulesCycles per rule, the kernel runs the first three and the contact push fused
+	int64 CohesionCycles = 0;
+	int64 SeparationCycles = 0;
+	int64 AlignmentCycles = 0;
+	int64 KernelCycles = 0;
+	int64 ContactPushCycles = 0;
+	int64 IntegrateCycles = 0;
+	int64 OrientCycles = 0;
+	int64 WallCycles = 0;
+	int64 NeighbourCount = 0;
+	//Boids that gathered neighbours and ran their rules, NeighbourCount is over these
+	int64 GatheredCount = 0;
+	int32 Steps = 0;
+	//Steps that rebuilt the Verlet lists, out of Steps
+	int32 VerletRebuilds = 0;
+
+	void Reset() { *this = FFlockStepTimings(); }
+
+	FFlockStepTimings& operator+=(const FFlockStepTimings& Other);
+};
+
+/**
+ * Structure-of-arrays state of a whole flock, stepped in one pass.
+ * Every array is indexed by boid index, so the hot loops only touch contiguous memory.
+ * Steps run on worker threads, reading the previous state and writing into a second buffer.
+ * Plain C++ on purpose, the manager actor owns one and so can a commandlet.
+ */
+class MYLAB_API FFlockSimulation
+{
+public:
+	FFlockSimulation();
+
+	int32 AddBoid(const FVector& Location, const FVector& Velocity, const FVector& SpawnLocation, uint8 SpeciesIndex = 0);
+
+	//Swap-removes a boid, the last boid takes over Index
+	void RemoveBoid(int32 Index);
+
+	void Reset();
+
+	FORCEINLINE int32 Num() const { return Positions.Num(); }
+
+	void Step(float DeltaTime);
+
+	//Rules, same maths as the ABoid functions of the same name
+	FVector Cohesion(int32 Index, const TArray<int32>& Neighbours) const;
+	FVector Separation(int32 Index, const TArray<int32>& Neighbours) const;
+	FVector Alignment(int32 Index, const TArray<int32>& Neighbours) const;
+	FVector MoveTowardOrigin(int32 Index) const;
+	FVector OrthonormalVelocity(int32 Index) const;
+
+	//Sum over touching neighbours of the push out of each other, scaled by penetration depth
+	FVector ContactPush(int32 Index, const TArray<int32>& Neighbours) const;
+
+	//Return to spawn plus the vortex, or FlowField where it covers the boid
+	FVector GlobalSteering(int32 Index) const;
+
+	//Steers down the obstacle field's gradient, harder the closer the surface
+	FVector FieldAvoidance(int32 Index) const;
+
+	//Steering of far boids, cohesion and alignment against the whole flock instead of neighbours
+	FVector CentroidSteering(int32 Index) const;
+
+	//Where the boid should be drawn, the simulated position plus the interpolation left over from its last re-evaluation
+	//and from its last correction, carried RenderLead seconds ahead
+	FORCEINLINE FVector GetRenderPosition(int32 Index) const
+	{
+		return Positions[Index] + RenderOffsets[Index] + CorrectionOffsets[Index] + Velocities[Index] * RenderLead;
+	}
+
+	//Snaps a boid to an authoritative state, e.g. from the server. The view stays put and DecayCorrections eases it over.
+	//Not safe during Step.
+	void CorrectBoid(int32 Index, const FVector& Location, const FVector& Velocity);
+
+	//Shrinks what is left of every correction, by e every SmoothingTime seconds
+	void DecayCorrections(float DeltaTime, float SmoothingTime);
+
+	//Slices the last step was split into, 1 when every boid was re-evaluated
+	FORCEINLINE int32 GetTimeSlices() const { return TimeSlices; }
+
+	//Flock params with the boid's species rates applied, the flock's own Params when there are no species
+	FORCEINLINE const FFlockParams& GetBoidParams(int32 Index) const
+	{
+		return SpeciesParams.Num() > 0 ? SpeciesParams[FMath::Min<int32>(BoidSpecies[Index], SpeciesParams.Num() - 1)] : Params;
+	}
+
+	//CRC of everything the next step reads, equal on two machines as long as their flocks are in sync.
+	//Orientations are left out, they never feed back into the simulation.
+	uint32 ComputeStateHash() const;
+
+	//Turns Current toward Velocity by ReOrientRate per 1/30 s, whatever DeltaTime is
+	static FQuat OrientTowards(const FQuat& Current, const FVector& Velocity, float ReOrientRate, float DeltaTime);
+
+private:
+	void GatherNeighbours(int32 Index, int32 MaxNeighbours, TArray<int32>& OutNeighbours) const;
+	//Moves the neighbours the boid's species avoids from Neighbours to OutAvoided
+	void SplitAvoided(int32 Index, TArray<int32>& Neighbours, TArray<int32>& OutAvoided) const;
+	//Resolves Species into per-species params and interaction masks, once per step
+	void UpdateSpecies();
+	//Grid cell size for the step, shrinks with the flock's density in topological mode
+	float ComputeGridCellSize() const;
+	FORCEINLINE bool UsesVerletLists() const { return Params.bVerletLists && !Params.bTopological; }
+	FORCEINLINE float GetVerletRadius() const { return Params.SensingRadius + FMath::Max(Params.VerletSkin, 0.f); }
+	//True once a boid may have come within SensingRadius of one missing from its list
+	bool NeedsVerletRebuild() const;
+	//Fills every boid's list from the grid, on worker threads
+	void BuildVerletLists();
+	EFlockLODTier ComputeLODTier(int32 Index) const;
+	//Centroid and mean heading of the flock, only needed when some boids are far
+	void UpdateFlockAverages();
+	//OutRuleTimings gets the cycles of each rule added when not null
+	FVector ComputeSteering(int32 Index, const TArray<int32>& Neighbours, const TArray<int32>& Avoided, FFlockNeighbourBuffer& Packed, FVector& OutContactPush, FFlockStepTimings* OutRuleTimings) const;
+	//Hands one step's timings to the stat system
+	void PublishStats(const FFlockStepTimings& StepTimings) const;
+	//Reads the current state, writes the boid's slot of the next one.
+	//SliceTime is the time since the boid was last re-evaluated, DeltaTime when not time slicing.
+	void IntegrateBoid(int32 Index, const FVector& Acceleration, float DeltaTime, float SliceTime);
+	//Moves a boid that isn't re-evaluated this step along its last velocity, Phase is its position in the slice cycle
+	void ExtrapolateBoid(int32 Index, float DeltaTime, uint32 Phase);
+	//Eases the facing toward the boid's new velocity, after it was integrated or extrapolated
+	void OrientBoid(int32 Index, float DeltaTime);
+
+//Variables
+public:
+	FFlockParams Params;
+
+	TArray<FVector> Positions;
+	TArray<FVector> Velocities;
+	TArray<FVector> SpawnLocations;
+
+	//Facing of every boid, eased toward its velocity as part of the step
+	TArray<FQuat> Orientations;
+
+	//Index into Species of every boid
+	TArray<uint8> BoidSpecies;
+
+	//Optional, at most 32. Species share the grid and the flock-wide settings of Params.
+	TArray<FFlockSpecies> Species;
+
+	//Filled from outside, e.g. by FFlockObstacleTracer, scaled by AvoidanceRate
+	TArray<FVector> Avoidance;
+
+	//Optional baked obstacles, read only so it is safe to sample from every worker
+	const UFlockObstacleField* ObstacleField;
+
+	//Optional, replaces OrthonormalVelocity inside its bounds
+	const FFlockFlowField* FlowField;
+
+	//Set from outside before stepping, LOD is off while empty
+	TArray<FFlockLODView> LODViews;
+
+	//Tier every boid was stepped with last
+	TArray<EFlockLODTier> LODTiers;
+
+	//Set by callers stepping at a fixed rate, to the time already gone toward the next step
+	float RenderLead;
+
+	//Accumulated over steps until reset, for benchmarks
+	bool bCollectTimings;
+	FFlockStepTimings Timings;
+
+private:
+	//Rebuilt at the start of every step, only along with the Verlet lists when they are used
+	FFlockSpatialGrid Grid;
+
+	//Candidates within GetVerletRadius of every boid, as of VerletAnchors.
+	//Boid i's run is VerletNeighbours from VerletOffsets[i] up to VerletOffsets[i + 1].
+	TArray<int32> VerletOffsets;
+	TArray<int32> VerletNeighbours;
+	TArray<FVector> VerletAnchors;
+
+	//What the lists were built with, any change rebuilds them
+	float VerletRadius;
+	TArray<uint32> VerletFlockMasks;
+	TArray<uint32> VerletAvoidMasks;
+
+	//Set when boids are added or removed, indices no longer match the lists
+	bool bVerletDirty;
+
+	//Steps since the last rebuild, and how many the previous lists lasted
+	int32 VerletAge;
+	int32 VerletLifetime;
+
+	//Resolved from Species at the start of every step, indexed by species
+	TArray<FFlockParams> SpeciesParams;
+	//Bits of the species each species flocks with, or avoids
+	TArray<uint32> FlockMasks;
+	TArray<uint32> AvoidMasks;
+
+	//Normalized steering direction, kept between steps for mid range boids
+	TArray<FVector> Steering;
+
+	FVector FlockCentroid;
+	FVector FlockHeading;
+
+	//Staggers the mid range rule updates and the time slices over steps
+	uint32 StepCount;
+
+	int32 TimeSlices;
+
+	//Time since every boid was last re-evaluated, not counting the current step
+	TArray<float> SliceElapsed;
+
+	//Rendered minus simulated position, set when a re-evaluated boid changes velocity and eased out before its next one
+	TArray<FVector> RenderOffsets;
+
+	//Rendered minus simulated position left over from CorrectBoid
+	TArray<FVector> CorrectionOffsets;
+
+	//Written during a step then swapped with Positions and Velocities
+	TArray<FVector> NextPositions;
+	TArray<FVector> NextVelocities;
+
+	//Boids per ParallelFor task
+	static constexpr int32 StepChunkSize = 128;
+};
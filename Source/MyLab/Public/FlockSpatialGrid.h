@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Uniform grid hashed into a flat table, rebuilt once per step with a counting sort.
+ * Answers "all boids within radius R of p" by only visiting the cells the sphere touches,
+ * so neighbour search stays linear with flock size instead of relying on physics overlaps.
+ */
+class MYLAB_API FFlockSpatialGrid
+{
+public:
+	FFlockSpatialGrid();
+
+	//Cell size should be about the query radius, so a query visits at most 27 cells.
+	//Species, below 32, is only needed by queries that filter with a species mask.
+	void Build(const TArray<FVector>& Positions, float NewCellSize, const TArray<uint8>* Species = nullptr);
+
+	//Appends to OutIndices every point within Radius of Location, except ExcludeIndex and points whose species bit isn't in SpeciesMask
+	void Query(const FVector& Location, float Radius, const TArray<FVector>& Positions, TArray<int32>& OutIndices, int32 ExcludeIndex = INDEX_NONE, uint32 SpeciesMask = MAX_uint32) const;
+
+	//Writes the Count points closest to Location and within MaxRadius, nearest first.
+	//Walks out one ring of cells at a time and stops once the Count-th point is closer than any unvisited cell.
+	//At most MaxRings rings are walked, which bounds the cells visited when they are small next to MaxRadius.
+	//The search radius is then cut to MaxRings cells, so the result is always the exact nearest within it.
+	void QueryNearest(const FVector& Location, int32 Count, float MaxRadius, int32 MaxRings, const TArray<FVector>& Positions, TArray<int32>& OutIndices, int32 ExcludeIndex = INDEX_NONE, uint32 SpeciesMask = MAX_uint32) const;
+
+	FORCEINLINE float GetCellSize() const { return CellSize; }
+
+	//Frees the tables, for grids that are only needed now and then. The next Build allocates them again.
+	void Empty();
+
+private:
+	FORCEINLINE FIntVector GetCell(const FVector& Location) const
+	{
+		return FIntVector(FMath::FloorToInt(Location.X * InvCellSize), FMath::FloorToInt(Location.Y * InvCellSize), FMath::FloorToInt(Location.Z * InvCellSize));
+	}
+
+	FORCEINLINE uint32 GetBucket(const FIntVector& Cell) const
+	{
+		//Large primes hash, as in Teschner et al.
+		return ((uint32(Cell.X) * 73856093u) ^ (uint32(Cell.Y) * 19349663u) ^ (uint32(Cell.Z) * 83492791u)) & BucketMask;
+	}
+
+//Variables
+private:
+	float CellSize;
+	float InvCellSize;
+	uint32 BucketMask;
+
+	//BucketStart[b] .. BucketStart[b + 1] is the range of SortedIndices in bucket b
+	TArray<int32> BucketStart;
+	TArray<int32> SortedIndices;
+	//Species bit of every entry of SortedIndices, empty when built without species
+	TArray<uint32> SortedSpeciesBits;
+	TArray<uint32> PointBuckets;
+};
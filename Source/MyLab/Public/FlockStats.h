@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+//"stat Flock" in game, the same scopes show up in Unreal Insights captures
+DECLARE_STATS_GROUP(TEXT("Flock"), STATGROUP_Flock, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Flock Tick"), STAT_FlockTick, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Step"), STAT_FlockStep, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Grid Build"), STAT_FlockGridBuild, STATGROUP_Flock, MYLAB_API);
+
+//Summed over every worker thread, set once per step from the step's own timings
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Neighbour Gathering"), STAT_FlockNeighbours, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Rules"), STAT_FlockRules, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Integration"), STAT_FlockIntegrate, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Orientation"), STAT_FlockOrient, STATGROUP_Flock, MYLAB_API);
+
+//Share of Rules, published the same way. The fused kernel replaces the others unless flock.SimdKernel is 0.
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cohesion"), STAT_FlockCohesion, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Separation"), STAT_FlockSeparation, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Alignment"), STAT_FlockAlignment, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Fused Kernel"), STAT_FlockKernel, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Contact Push"), STAT_FlockContactPush, STATGROUP_Flock, MYLAB_API);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Obstacle Traces"), STAT_FlockObstacleTraces, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Push Views"), STAT_FlockPushViews, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Push Instances"), STAT_FlockPushInstances, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Standalone Boid Tick"), STAT_BoidTick, STATGROUP_Flock, MYLAB_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Tornado"), STAT_FlockTornado, STATGROUP_Flock, MYLAB_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Boids"), STAT_FlockBoids, STATGROUP_Flock, MYLAB_API);
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Average Neighbours"), STAT_FlockAverageNeighbours, STATGROUP_Flock, MYLAB_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Replicated Bytes per Client"), STAT_FlockNetBytes, STATGROUP_Flock, MYLAB_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Verlet List Rebuilds"), STAT_FlockVerletRebuilds, STATGROUP_Flock, MYLAB_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Steps per Verlet Rebuild"), STAT_FlockVerletLifetime, STATGROUP_Flock, MYLAB_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Tornado Bodies"), STAT_FlockTornadoBodies, STATGROUP_Flock, MYLAB_API);
+
+//Adds cycles measured elsewhere to a cycle stat, SET_CYCLE_COUNTER would drop what other flocks added this frame
+#if STATS
+#define INC_FLOCK_CYCLE_COUNTER_BY(Stat, Cycles) \
+	FThreadStats::AddMessage(GET_STATFNAME(Stat), EStatOperation::Add, int64(Cycles), true)
+#else
+#define INC_FLOCK_CYCLE_COUNTER_BY(Stat, Cycles)
+#endif
+
+//Cycle counter and Insights scope in one, for scopes that run a few times per frame.
+//Per boid work is timed with plain cycle reads and published through INC_FLOCK_CYCLE_COUNTER_BY instead.
+#define FLOCK_SCOPE_CYCLE_COUNTER(Stat) \
+	SCOPE_CYCLE_COUNTER(Stat); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(Stat)
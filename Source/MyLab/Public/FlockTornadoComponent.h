@@ -0,0 +1,126 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/SplineComponent.h"
+#include "Engine/EngineTypes.h"
+#include "WorldCollision.h"
+#include "FlockFlowField.h"
+#include "FlockTornadoComponent.generated.h"
+
+struct FBodyInstance;
+
+/**
+ * A tornado whose funnel follows the spline, from the first point at the ground to the last at the top.
+ * Every frame one async overlap finds the simulating bodies around it, the swirl, lift and pull on all of them
+ * is evaluated in one parallel pass and applied under a single physics scene lock.
+ * Flocks feel it through AFlockManager::FlowFieldTornadoes.
+ */
+UCLASS(ClassGroup = (Flock), meta = (BlueprintSpawnableComponent))
+class MYLAB_API UFlockTornadoComponent : public USplineComponent
+{
+	GENERATED_BODY()
+
+public:
+	// Sets default values for this component's properties
+	UFlockTornadoComponent();
+
+protected:
+	// Called when the game starts
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+public:
+	// Called every frame
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+
+	//Resamples the funnel from the spline, done every tick. Call it after moving the spline from Blueprint mid frame.
+	UFUNCTION(BlueprintCallable, Category = "Tornado")
+	void UpdateFunnel();
+
+	//Flow at Point in the units of FFlockFlowElement, from the closest stretch of the funnel. Safe on worker threads.
+	FVector Evaluate(const FVector& Point) const;
+
+	//World box everything the tornado touches lies in
+	FBox GetInfluenceBounds() const;
+
+	UFUNCTION(BlueprintPure, Category = "Tornado")
+	int32 GetAffectedBodyCount() const { return BodiesLastFrame; }
+
+private:
+	//Simulating bodies from last frame's overlap, each once
+	void ConsumeOverlap(UWorld* World);
+	void IssueOverlap(UWorld* World);
+
+	void ApplyForces(UWorld* World);
+
+	//OutWeight fades from 1 to 0 over the edge of the influence
+	FVector EvaluateFunnel(const FVector& Point, float& OutWeight) const;
+
+//Variables
+public:
+	//Swirl at the edge of the core, the strength of a vortex flow element
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float Strength;
+
+	//The swirl peaks here and falls off as 1/distance outside
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "0.0", UIMax = "5000.0"))
+	float CoreRadius;
+
+	//Pull toward the funnel and push up it, as fractions of the swirl
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "0.0", UIMax = "1.0"))
+	float Inflow;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "-1.0", UIMax = "1.0"))
+	float Lift;
+
+	//Seen from above
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado")
+	bool bClockwise;
+
+	//Nothing further from the funnel is touched, the flow fades out over the last quarter
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "100.0", UIMax = "20000.0"))
+	float InfluenceRadius;
+
+	//Straight stretches the funnel is cut into along the spline
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Tornado", meta = (UIMin = "1", UIMax = "32"))
+	int32 FunnelSegments;
+
+	//Wind speed a flow of 1 blows at
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Physics", meta = (UIMin = "0.0", UIMax = "10000.0"))
+	float WindSpeed;
+
+	//How fast bodies are dragged to the wind speed, per second. Mass is ignored so crates and barrels fly alike.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Physics", meta = (UIMin = "0.0", UIMax = "10.0"))
+	float Drag;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Physics", meta = (UIMin = "0.0", UIMax = "20000.0"))
+	float MaxAcceleration;
+
+	//Object types swept up, only bodies that simulate physics are pushed
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Physics")
+	TArray<TEnumAsByte<EObjectTypeQuery>> ObjectTypes;
+
+	//Bodies pushed per frame at most, the rest wait for a later overlap
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Physics", meta = (UIMin = "0", UIMax = "4096"))
+	int32 MaxBodies;
+
+private:
+	//World space, one vortex per stretch of the funnel
+	TArray<FFlockFlowElement> Funnel;
+	FBox FunnelBounds;
+
+	FTraceHandle OverlapHandle;
+
+	//Only valid within the tick they were gathered in
+	TArray<FBodyInstance*> Bodies;
+	TArray<FVector> BodyLocations;
+	TArray<FVector> BodyVelocities;
+	TArray<FVector> BodyAccelerations;
+
+	int32 BodiesLastFrame;
+
+	//Bodies per worker task
+	static constexpr int32 ChunkSize = 64;
+};
@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "FlockWarmupState.generated.h"
+
+struct FFlockParams;
+struct FFlockSpecies;
+class UFlockObstacleField;
+
+/**
+ * Settled state of a flock, pre-simulated in the editor and loaded by a flock manager at BeginPlay.
+ * The boids start where a flock would be after SimulatedSeconds, instead of at the spawn point.
+ * Everything is stored relative to the manager, so the level can move it around after baking.
+ */
+UCLASS(BlueprintType)
+class MYLAB_API UFlockWarmupState : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	FORCEINLINE int32 Num() const { return Positions.Num(); }
+
+	FORCEINLINE bool IsValid() const
+	{
+		return Positions.Num() > 0 && Velocities.Num() == Positions.Num() && SpawnOffsets.Num() == Positions.Num() && Orientations.Num() == Positions.Num();
+	}
+
+#if WITH_EDITOR
+	//Spawns Count boids within SpawnRadius of Origin like AFlockManager::SpawnBoids, then steps them for Seconds at StepRate Hz.
+	//They are all of the first species, as the manager's initial boids are, with the rates Species gives it.
+	bool Bake(const FFlockParams& Params, const TArray<FFlockSpecies>& Species, const UFlockObstacleField* ObstacleField, const FVector& Origin, int32 Count, float SpawnRadius, float Seconds, float StepRate);
+#endif
+
+//Variables
+public:
+	UPROPERTY(VisibleAnywhere, Category = "Warm-up")
+	float SimulatedSeconds;
+
+	//Relative to the flock origin
+	UPROPERTY()
+	TArray<FVector> Positions;
+
+	UPROPERTY()
+	TArray<FVector> Velocities;
+
+	//Relative to the flock origin
+	UPROPERTY()
+	TArray<FVector> SpawnOffsets;
+
+	UPROPERTY()
+	TArray<FQuat> Orientations;
+};